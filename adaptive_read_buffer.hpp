@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Buffer for reads from the PTY master. The read size doubles while reads
+// keep filling it and is halved again after a run of small reads. The memory
+// is only given back once the read size is down to the minimum again.
+class adaptive_read_buffer {
+public:
+    static constexpr std::size_t min_read_size = 4 * 1024;
+    static constexpr std::size_t max_read_size = 64 * 1024;
+    static constexpr std::size_t small_reads_before_shrink = 16;
+
+    char* data() { return m_buffer.data(); }
+    // How much the next read should ask for.
+    std::size_t get_read_size() const { return m_read_size; }
+    std::size_t get_capacity() const { return m_buffer.capacity(); }
+
+    // Called with the byte count of every read.
+    void adapt(std::size_t count) {
+        if (count == m_read_size) {
+            m_small_reads = 0;
+            if (m_read_size < max_read_size) {
+                m_read_size *= 2;
+                m_buffer.resize(m_read_size);
+            }
+        }
+        else if (count < m_read_size / 4 && m_read_size > min_read_size) {
+            if (++m_small_reads >= small_reads_before_shrink) {
+                m_small_reads = 0;
+                m_read_size /= 2;
+                if (m_read_size == min_read_size) {
+                    m_buffer.resize(m_read_size);
+                    m_buffer.shrink_to_fit();
+                }
+            }
+        }
+        else {
+            m_small_reads = 0;
+        }
+    }
+private:
+    std::vector<char> m_buffer = std::vector<char>(min_read_size);
+    std::size_t m_read_size = min_read_size;
+    std::size_t m_small_reads = 0;
+};
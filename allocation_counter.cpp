@@ -0,0 +1,115 @@
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// The replacements live in their own translation unit: inlined next to the
+// standard containers, GCC pairs the new expression with the free below and
+// reports a mismatched deallocation.
+namespace {
+
+std::atomic<std::size_t> allocation_count{0};
+
+// Over-aligned blocks are carved out of a larger malloc block, whose address
+// is kept just before the aligned one.
+void* allocate(std::size_t size, std::size_t alignment) noexcept {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = size == 0 ? 1 : size;
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size);
+    }
+    auto block = static_cast<char*>(std::malloc(size + alignment + sizeof(void*)));
+    if (block == nullptr) {
+        return nullptr;
+    }
+    auto aligned = (reinterpret_cast<std::uintptr_t>(block) + sizeof(void*) + alignment - 1) & ~(alignment - 1);
+    auto p = reinterpret_cast<void**>(aligned);
+    p[-1] = block;
+    return p;
+}
+
+void* allocate_or_throw(std::size_t size, std::size_t alignment) {
+    if (auto p = allocate(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void deallocate(void* p, std::size_t alignment) noexcept {
+    if (p != nullptr && alignment > alignof(std::max_align_t)) {
+        p = static_cast<void**>(p)[-1];
+    }
+    std::free(p);
+}
+
+constexpr auto default_alignment = alignof(std::max_align_t);
+
+}
+
+std::size_t get_allocation_count() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    return allocate_or_throw(size, default_alignment);
+}
+void* operator new[](std::size_t size) {
+    return allocate_or_throw(size, default_alignment);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size, default_alignment);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size, default_alignment);
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept {
+    deallocate(p, default_alignment);
+}
+void operator delete[](void* p) noexcept {
+    deallocate(p, default_alignment);
+}
+void operator delete(void* p, std::size_t) noexcept {
+    deallocate(p, default_alignment);
+}
+void operator delete[](void* p, std::size_t) noexcept {
+    deallocate(p, default_alignment);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    deallocate(p, default_alignment);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    deallocate(p, default_alignment);
+}
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept {
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept {
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of calls to the global allocation functions so far. Linking
+// allocation_counter.cpp into a program replaces all of them, including the
+// array, nothrow and aligned forms, with counting versions.
+std::size_t get_allocation_count();
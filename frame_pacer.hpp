@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+
+// Decides when to draw: at most once per display refresh, however many
+// updates arrived since the last frame, and never while nothing changed, so
+// an idle terminal does not wake up. The owner runs the timer.
+class frame_pacer {
+public:
+    enum class action {
+        none,
+        // draw now
+        present,
+        // arm a timer for get_next_frame() and ask again when it fires
+        wait,
+    };
+
+    explicit frame_pacer(std::chrono::nanoseconds interval) : m_interval{interval} {}
+
+    void mark_dirty() { m_dirty = true; }
+    bool is_dirty() const { return m_dirty; }
+    std::chrono::steady_clock::time_point get_next_frame() const { return m_next_frame; }
+
+    action next_action(std::chrono::steady_clock::time_point now) {
+        if (!m_dirty || m_waiting) {
+            return action::none;
+        }
+        if (now >= m_next_frame) {
+            return action::present;
+        }
+        m_waiting = true;
+        return action::wait;
+    }
+    void timer_fired() { m_waiting = false; }
+    // The screen is about to be drawn; changes from here on need a new frame.
+    void frame_started() { m_dirty = false; }
+    // Called only when a frame was actually shown.
+    void frame_presented(std::chrono::steady_clock::time_point now) { m_next_frame = now + m_interval; }
+private:
+    std::chrono::nanoseconds m_interval;
+    std::chrono::steady_clock::time_point m_next_frame{};
+    bool m_dirty = true;
+    bool m_waiting = false;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// A wide glyph spans two cells, so its width does not fit in a byte once
+// cells are wider than 127 pixels.
+struct glyph_key {
+    uint32_t codepoint;
+    uint16_t attributes;
+    uint16_t width;
+    uint8_t height;
+
+    // codepoints are at most 21 bits, which leaves 24 for them at the top
+    uint64_t pack() const {
+        return uint64_t{codepoint} << 40 | uint64_t{attributes} << 24 | uint64_t{width} << 8 | height;
+    }
+};
+
+// Coverage bitmaps of the glyphs drawn recently, packed into one fixed-size
+// 8-bit atlas. A glyph is rasterized the first time it is looked up. Slots
+// are allocated on shelves of equal-sized slots, so when the atlas is full
+// the least recently used glyph of the same size gives up its slot. Memory
+// use is therefore bounded by the atlas size, however many distinct
+// codepoints a session draws.
+class glyph_cache {
+public:
+    struct glyph_view {
+        const uint8_t* coverage = nullptr;
+        int stride = 0;
+
+        explicit operator bool() const {
+            return coverage != nullptr;
+        }
+    };
+
+    glyph_cache(int atlas_width = 512, int atlas_height = 512) :
+        m_atlas_width{atlas_width}, m_atlas_height{atlas_height},
+        m_atlas(static_cast<std::size_t>(atlas_width) * atlas_height)
+    {}
+
+    // rasterize(std::span<uint8_t>) fills key.width * key.height bytes of
+    // coverage and returns false when there is no glyph to draw. That answer
+    // is remembered too, without taking atlas space, so a missing glyph is
+    // not rasterized again on every redraw.
+    template<class Rasterize>
+    glyph_view get(glyph_key key, Rasterize&& rasterize) {
+        auto packed = key.pack();
+        if (auto it = m_index.find(packed); it != m_index.end()) {
+            ++m_hits;
+            if (it->second == none) {
+                return {};
+            }
+            auto& e = m_entries[it->second];
+            move_to_front(it->second);
+            return {m_atlas.data() + e.y * m_atlas_width + e.x, m_atlas_width};
+        }
+        ++m_misses;
+        int width = key.width;
+        int height = key.height;
+        m_scratch.resize(static_cast<std::size_t>(width) * height);
+        if (!rasterize(std::span<uint8_t>{m_scratch})) {
+            m_index.emplace(packed, none);
+            return {};
+        }
+        auto index = allocate(width, height);
+        if (!index) {
+            return {m_scratch.data(), width};
+        }
+        auto& e = m_entries[*index];
+        e.key = packed;
+        m_index.emplace(packed, *index);
+        push_front(*index);
+        auto origin = m_atlas.data() + e.y * m_atlas_width + e.x;
+        for (int line = 0; line < height; ++line) {
+            std::copy_n(m_scratch.data() + line * width, width, origin + line * m_atlas_width);
+        }
+        return {origin, m_atlas_width};
+    }
+    uint64_t get_hits() const { return m_hits; }
+    uint64_t get_misses() const { return m_misses; }
+    uint64_t get_evictions() const { return m_evictions; }
+    double get_hit_rate() const {
+        auto lookups = m_hits + m_misses;
+        return lookups == 0 ? 0.0 : static_cast<double>(m_hits) / lookups;
+    }
+private:
+    static constexpr uint32_t none = ~uint32_t{0};
+
+    struct shelf {
+        int y;
+        int slot_width;
+        int height;
+        int next_x;
+    };
+    struct entry {
+        uint64_t key;
+        int x;
+        int y;
+        int width;
+        int height;
+        uint32_t previous = none;
+        uint32_t next = none;
+    };
+
+    std::optional<uint32_t> allocate(int width, int height) {
+        for (auto& s : m_shelves) {
+            if (s.slot_width == width && s.height == height && s.next_x + width <= m_atlas_width) {
+                m_entries.push_back(entry{0, s.next_x, s.y, width, height});
+                s.next_x += width;
+                return static_cast<uint32_t>(m_entries.size() - 1);
+            }
+        }
+        if (width <= m_atlas_width && m_next_shelf_y + height <= m_atlas_height) {
+            m_shelves.push_back(shelf{m_next_shelf_y, width, height, width});
+            m_entries.push_back(entry{0, 0, m_next_shelf_y, width, height});
+            m_next_shelf_y += height;
+            return static_cast<uint32_t>(m_entries.size() - 1);
+        }
+        for (auto index = m_tail; index != none; index = m_entries[index].previous) {
+            auto& e = m_entries[index];
+            if (e.width == width && e.height == height) {
+                unlink(index);
+                m_index.erase(e.key);
+                ++m_evictions;
+                return index;
+            }
+        }
+        return std::nullopt;
+    }
+    void unlink(uint32_t index) {
+        auto& e = m_entries[index];
+        (e.previous == none ? m_head : m_entries[e.previous].next) = e.next;
+        (e.next == none ? m_tail : m_entries[e.next].previous) = e.previous;
+        e.previous = e.next = none;
+    }
+    void push_front(uint32_t index) {
+        auto& e = m_entries[index];
+        e.previous = none;
+        e.next = m_head;
+        (m_head == none ? m_tail : m_entries[m_head].previous) = index;
+        m_head = index;
+    }
+    void move_to_front(uint32_t index) {
+        if (m_head != index) {
+            unlink(index);
+            push_front(index);
+        }
+    }
+
+    int m_atlas_width;
+    int m_atlas_height;
+    std::vector<uint8_t> m_atlas;
+    std::vector<uint8_t> m_scratch;
+    std::vector<shelf> m_shelves;
+    int m_next_shelf_y = 0;
+    std::vector<entry> m_entries;
+    std::unordered_map<uint64_t, uint32_t> m_index;
+    uint32_t m_head = none;
+    uint32_t m_tail = none;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+};
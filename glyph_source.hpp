@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Glyph sources for the software renderer. Each mixin provides
+//   std::pair<int, int> get_cell_size()
+//   bool rasterize_glyph(uint32_t codepoint, int width, int height, std::span<uint8_t> coverage)
+// where coverage is width * height bytes of 0-255 alpha, row by row. A source
+// that has no glyph for a codepoint defers to its parent.
+
+// Last-resort source: an outlined box for every visible codepoint, so the
+// layout of a screen is recognizable without any font file.
+template<class T>
+class add_box_glyphs : public T {
+public:
+    std::pair<int, int> get_cell_size() {
+        return {8, 16};
+    }
+    bool rasterize_glyph(uint32_t codepoint, int width, int height, std::span<uint8_t> coverage) {
+        std::fill(coverage.begin(), coverage.end(), 0);
+        if (codepoint <= ' ' || width < 4 || height < 4) {
+            return true;
+        }
+        auto top = height / 4;
+        auto bottom = height - 2;
+        for (int y = top; y <= bottom; ++y) {
+            for (int x = 1; x < width - 1; ++x) {
+                if (y == top || y == bottom || x == 1 || x == width - 2) {
+                    coverage[y * width + x] = 0xff;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// Bitmap console fonts in PC Screen Font format, version 1 or 2, as shipped
+// by kbd in /usr/share/consolefonts. The Unicode table is used when the font
+// has one; otherwise glyph indices are taken as codepoints.
+template<class T>
+class add_psf_glyphs : public T {
+public:
+    using parent = T;
+    void load_psf_font(const std::string& path) {
+        std::ifstream file{path, std::ios::binary};
+        if (!file) {
+            throw std::runtime_error{"cannot open font " + path};
+        }
+        std::vector<uint8_t> data{std::istreambuf_iterator<char>{file}, {}};
+        if (data.size() >= 4 && data[0] == 0x72 && data[1] == 0xb5 && data[2] == 0x4a && data[3] == 0x86) {
+            load_psf2(data);
+        }
+        else if (data.size() >= 4 && data[0] == 0x36 && data[1] == 0x04) {
+            load_psf1(data);
+        }
+        else {
+            throw std::runtime_error{path + " is not a PSF font"};
+        }
+    }
+    std::pair<int, int> get_cell_size() {
+        return m_glyph_count == 0 ? parent::get_cell_size() : std::pair{m_width, m_height};
+    }
+    bool rasterize_glyph(uint32_t codepoint, int width, int height, std::span<uint8_t> coverage) {
+        auto index = glyph_index(codepoint);
+        if (index >= m_glyph_count) {
+            return parent::rasterize_glyph(codepoint, width, height, coverage);
+        }
+        std::fill(coverage.begin(), coverage.end(), 0);
+        auto row_bytes = (m_width + 7) / 8;
+        auto glyph = m_glyphs.data() + index * m_glyph_bytes;
+        // a glyph narrower than the cells it is drawn over, such as a
+        // single-width glyph for a wide character, is centered
+        auto left = std::max(0, (width - m_width) / 2);
+        for (int y = 0; y < std::min(height, m_height); ++y) {
+            for (int x = 0; x < std::min(width, m_width); ++x) {
+                if (glyph[y * row_bytes + x / 8] & (0x80 >> (x % 8))) {
+                    coverage[y * width + left + x] = 0xff;
+                }
+            }
+        }
+        return true;
+    }
+private:
+    static uint32_t read_u32(const std::vector<uint8_t>& data, std::size_t offset) {
+        return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 | static_cast<uint32_t>(data[offset + 3]) << 24;
+    }
+    void load_glyphs(const std::vector<uint8_t>& data, std::size_t offset, uint32_t count, uint32_t glyph_bytes, int width, int height) {
+        if (data.size() < offset + std::size_t{count} * glyph_bytes) {
+            throw std::runtime_error{"truncated PSF font"};
+        }
+        m_glyphs.assign(data.begin() + offset, data.begin() + offset + std::size_t{count} * glyph_bytes);
+        m_glyph_count = count;
+        m_glyph_bytes = glyph_bytes;
+        m_width = width;
+        m_height = height;
+        m_unicode.clear();
+    }
+    void load_psf1(const std::vector<uint8_t>& data) {
+        auto mode = data[2];
+        uint32_t count = mode & 0x01 ? 512 : 256;
+        load_glyphs(data, 4, count, data[3], 8, data[3]);
+        if ((mode & 0x06) == 0) {
+            return;
+        }
+        // One list of UCS-2 values per glyph, ended by 0xffff. Values after
+        // 0xfffe describe combining sequences, which are skipped.
+        auto offset = 4 + std::size_t{count} * data[3];
+        for (uint32_t glyph = 0; glyph < count && offset + 1 < data.size(); ++glyph) {
+            bool in_sequence = false;
+            for (; offset + 1 < data.size(); offset += 2) {
+                auto value = static_cast<uint32_t>(data[offset] | data[offset + 1] << 8);
+                if (value == 0xffff) {
+                    offset += 2;
+                    break;
+                }
+                in_sequence = in_sequence || value == 0xfffe;
+                if (!in_sequence) {
+                    m_unicode.emplace(value, glyph);
+                }
+            }
+        }
+    }
+    void load_psf2(const std::vector<uint8_t>& data) {
+        if (data.size() < 32) {
+            throw std::runtime_error{"truncated PSF font"};
+        }
+        auto header_size = read_u32(data, 8);
+        auto flags = read_u32(data, 12);
+        auto count = read_u32(data, 16);
+        auto glyph_bytes = read_u32(data, 20);
+        auto height = static_cast<int>(read_u32(data, 24));
+        auto width = static_cast<int>(read_u32(data, 28));
+        load_glyphs(data, header_size, count, glyph_bytes, width, height);
+        if ((flags & 0x01) == 0) {
+            return;
+        }
+        // One list of UTF-8 strings per glyph, ended by 0xff. Strings after
+        // 0xfe describe combining sequences, which are skipped.
+        auto offset = header_size + std::size_t{count} * glyph_bytes;
+        for (uint32_t glyph = 0; glyph < count && offset < data.size(); ++glyph) {
+            bool in_sequence = false;
+            while (offset < data.size()) {
+                auto byte = data[offset];
+                if (byte == 0xff) {
+                    ++offset;
+                    break;
+                }
+                if (byte == 0xfe) {
+                    in_sequence = true;
+                    ++offset;
+                    continue;
+                }
+                auto length = byte < 0x80 ? 1 : byte < 0xe0 ? 2 : byte < 0xf0 ? 3 : 4;
+                uint32_t codepoint = length == 1 ? byte : byte & (0x7f >> length);
+                for (int i = 1; i < length && offset + i < data.size(); ++i) {
+                    codepoint = codepoint << 6 | (data[offset + i] & 0x3f);
+                }
+                offset += length;
+                if (!in_sequence) {
+                    m_unicode.emplace(codepoint, glyph);
+                }
+            }
+        }
+    }
+    uint32_t glyph_index(uint32_t codepoint) {
+        if (m_unicode.empty()) {
+            return codepoint;
+        }
+        auto it = m_unicode.find(codepoint);
+        return it == m_unicode.end() ? m_glyph_count : it->second;
+    }
+
+    std::vector<uint8_t> m_glyphs;
+    uint32_t m_glyph_count = 0;
+    uint32_t m_glyph_bytes = 0;
+    int m_width = 0;
+    int m_height = 0;
+    std::unordered_map<uint32_t, uint32_t> m_unicode;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Fallback for the render buffer type that vulkan_renderer normally provides,
+// so the headless targets build without the renderer. Only the part of the
+// interface that terminal_buffer_manager uses is implemented.
+template<class T>
+class multidimention_vector {
+public:
+    multidimention_vector(std::size_t width, std::size_t height) :
+        m_width{width}, m_height{height}, m_data(width * height)
+    {}
+    std::size_t get_width() const { return m_width; }
+    std::size_t get_height() const { return m_height; }
+    std::size_t size() const { return m_data.size(); }
+    T* data() { return m_data.data(); }
+    const T* data() const { return m_data.data(); }
+    auto begin() { return m_data.begin(); }
+    auto end() { return m_data.end(); }
+    auto begin() const { return m_data.begin(); }
+    auto end() const { return m_data.end(); }
+private:
+    std::size_t m_width;
+    std::size_t m_height;
+    std::vector<T> m_data;
+};
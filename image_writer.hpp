@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Writers for RGBA pixels stored as uint32_t with R in the lowest byte.
+// Both formats are written without compression so output is byte-for-byte
+// stable, which is what golden-image comparisons need.
+
+inline void write_ppm(const std::string& path, int width, int height, std::span<const uint32_t> pixels) {
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error{"cannot write " + path};
+    }
+    file << "P6\n" << width << ' ' << height << "\n255\n";
+    std::vector<char> row(static_cast<std::size_t>(width) * 3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            auto pixel = pixels[static_cast<std::size_t>(y) * width + x];
+            row[x * 3] = static_cast<char>(pixel);
+            row[x * 3 + 1] = static_cast<char>(pixel >> 8);
+            row[x * 3 + 2] = static_cast<char>(pixel >> 16);
+        }
+        file.write(row.data(), row.size());
+    }
+}
+
+namespace png_detail {
+    constexpr auto crc_table = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            auto c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    inline void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+    inline void put_chunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> chunk;
+        put_u32(chunk, static_cast<uint32_t>(data.size()));
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        uint32_t crc = 0xffffffff;
+        for (auto i = std::size_t{4}; i < chunk.size(); ++i) {
+            crc = crc_table[(crc ^ chunk[i]) & 0xff] ^ (crc >> 8);
+        }
+        put_u32(chunk, crc ^ 0xffffffff);
+        file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    }
+}
+
+// 8-bit RGBA PNG whose zlib stream uses stored (uncompressed) deflate blocks.
+inline void write_png(const std::string& path, int width, int height, std::span<const uint32_t> pixels) {
+    using namespace png_detail;
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error{"cannot write " + path};
+    }
+    file.write("\x89PNG\r\n\x1a\n", 8);
+
+    std::vector<uint8_t> header;
+    put_u32(header, width);
+    put_u32(header, height);
+    header.insert(header.end(), {8, 6, 0, 0, 0});
+    put_chunk(file, "IHDR", header);
+
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<std::size_t>(height) * (width * 4 + 1));
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        for (int x = 0; x < width; ++x) {
+            auto pixel = pixels[static_cast<std::size_t>(y) * width + x];
+            raw.insert(raw.end(), {static_cast<uint8_t>(pixel), static_cast<uint8_t>(pixel >> 8),
+                static_cast<uint8_t>(pixel >> 16), static_cast<uint8_t>(pixel >> 24)});
+        }
+    }
+    std::vector<uint8_t> stream{0x78, 0x01};
+    constexpr std::size_t max_block = 0xffff;
+    for (std::size_t offset = 0; offset == 0 || offset < raw.size(); offset += max_block) {
+        auto length = std::min(max_block, raw.size() - offset);
+        auto last = offset + length == raw.size();
+        stream.insert(stream.end(), {static_cast<uint8_t>(last), static_cast<uint8_t>(length), static_cast<uint8_t>(length >> 8),
+            static_cast<uint8_t>(~length), static_cast<uint8_t>(~length >> 8)});
+        stream.insert(stream.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (auto byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(stream, b << 16 | a);
+    put_chunk(file, "IDAT", stream);
+    put_chunk(file, "IEND", {});
+}
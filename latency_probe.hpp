@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Histogram of durations in nanoseconds with log-linear buckets, as in HDR
+// histograms: each power of two is split into sub_buckets equal steps, so a
+// percentile is reported within 1/sub_buckets of the recorded value at any
+// magnitude, in constant memory and with O(1) recording.
+class latency_histogram {
+public:
+    static constexpr int sub_bucket_bits = 5;
+    static constexpr uint64_t sub_buckets = 1 << sub_bucket_bits;
+
+    void record(uint64_t value) {
+        ++m_counts[bucket_index(value)];
+        ++m_count;
+        m_max = std::max(m_max, value);
+    }
+    uint64_t get_count() const { return m_count; }
+    uint64_t get_max() const { return m_max; }
+    // Midpoint of the bucket holding the value at the given percentile.
+    uint64_t value_at_percentile(double percentile) const {
+        if (m_count == 0) {
+            return 0;
+        }
+        auto target = static_cast<uint64_t>(percentile / 100 * m_count + 0.5);
+        target = std::clamp<uint64_t>(target, 1, m_count);
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < m_counts.size(); ++i) {
+            seen += m_counts[i];
+            if (seen >= target) {
+                return std::min(bucket_midpoint(i), m_max);
+            }
+        }
+        return m_max;
+    }
+private:
+    static constexpr int max_shift = 64 - sub_bucket_bits - 1;
+
+    static std::size_t bucket_index(uint64_t value) {
+        if (value < sub_buckets) {
+            return value;
+        }
+        auto shift = std::bit_width(value) - sub_bucket_bits - 1;
+        return (shift + 1) * sub_buckets + ((value >> shift) - sub_buckets);
+    }
+    static uint64_t bucket_midpoint(std::size_t index) {
+        if (index < sub_buckets) {
+            return index;
+        }
+        auto shift = index / sub_buckets - 1;
+        auto lower = (sub_buckets + index % sub_buckets) << shift;
+        return lower + (uint64_t{1} << shift) / 2;
+    }
+
+    std::array<uint64_t, (max_shift + 2) * sub_buckets> m_counts{};
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
+
+enum class latency_stage {
+    pty_round_trip,
+    parse,
+    frame_wait,
+    render,
+    present,
+    total,
+    count,
+};
+
+inline const char* latency_stage_name(latency_stage stage) {
+    switch (stage) {
+        case latency_stage::pty_round_trip: return "pty_round_trip";
+        case latency_stage::parse: return "parse";
+        case latency_stage::frame_wait: return "frame_wait";
+        case latency_stage::render: return "render";
+        case latency_stage::present: return "present";
+        case latency_stage::total: return "total";
+        case latency_stage::count: break;
+    }
+    return "unknown";
+}
+
+// Follows one keypress at a time from the window callback to the frame that
+// shows the PTY output it produced:
+//   key -> first read after it       pty_round_trip
+//   that read lexed into the grid    parse (lexing and grid updates interleave)
+//   -> frame starts                  frame_wait (snapshot handoff and pacing)
+//   grid -> render buffer            render
+//   renderer run                     present
+// Keys pressed while one is being followed are not measured separately, and
+// a key that produces no output is dropped after key_timeout. Reads may run
+// on the ingest thread; everything else runs on the window thread.
+class latency_probe {
+public:
+    static constexpr auto key_timeout = std::chrono::seconds{1};
+
+    void key_event() {
+        auto now = timestamp();
+        auto key = m_key.load(std::memory_order_acquire);
+        if (key != 0 && now - key < static_cast<uint64_t>(std::chrono::nanoseconds{key_timeout}.count())) {
+            return;
+        }
+        m_read.store(0, std::memory_order_relaxed);
+        m_parsed.store(0, std::memory_order_relaxed);
+        m_key.store(now, std::memory_order_release);
+    }
+    void read_started() {
+        if (m_key.load(std::memory_order_acquire) != 0 && m_read.load(std::memory_order_relaxed) == 0) {
+            m_read.store(timestamp(), std::memory_order_relaxed);
+        }
+    }
+    void read_processed() {
+        if (m_read.load(std::memory_order_relaxed) != 0 && m_parsed.load(std::memory_order_relaxed) == 0) {
+            m_parsed.store(timestamp(), std::memory_order_release);
+        }
+    }
+    void frame_started() {
+        m_frame_started = timestamp();
+    }
+    void frame_rendered() {
+        m_frame_rendered = timestamp();
+    }
+    void frame_presented() {
+        auto parsed = m_parsed.load(std::memory_order_acquire);
+        auto key = m_key.load(std::memory_order_relaxed);
+        // a measured key leaves its timestamps behind until the next one
+        if (key == 0 || parsed == 0 || parsed > m_frame_started) {
+            return;
+        }
+        auto read = m_read.load(std::memory_order_relaxed);
+        auto now = timestamp();
+        record(latency_stage::pty_round_trip, read - key);
+        record(latency_stage::parse, parsed - read);
+        record(latency_stage::frame_wait, m_frame_started - parsed);
+        record(latency_stage::render, m_frame_rendered - m_frame_started);
+        record(latency_stage::present, now - m_frame_rendered);
+        record(latency_stage::total, now - key);
+        m_key.store(0, std::memory_order_release);
+    }
+    void dump(std::ostream& out) const {
+        out << "stage count p50_us p95_us p99_us max_us\n";
+        for (int i = 0; i < static_cast<int>(latency_stage::count); ++i) {
+            auto& histogram = m_histograms[i];
+            out << latency_stage_name(static_cast<latency_stage>(i)) << ' ' << histogram.get_count()
+                << ' ' << histogram.value_at_percentile(50) / 1000.0
+                << ' ' << histogram.value_at_percentile(95) / 1000.0
+                << ' ' << histogram.value_at_percentile(99) / 1000.0
+                << ' ' << histogram.get_max() / 1000.0 << '\n';
+        }
+        out.flush();
+    }
+private:
+    static uint64_t timestamp() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void record(latency_stage stage, uint64_t value) {
+        m_histograms[static_cast<int>(stage)].record(value);
+    }
+
+    std::atomic<uint64_t> m_key{0};
+    std::atomic<uint64_t> m_read{0};
+    std::atomic<uint64_t> m_parsed{0};
+    uint64_t m_frame_started = 0;
+    uint64_t m_frame_rendered = 0;
+    std::array<latency_histogram, static_cast<int>(latency_stage::count)> m_histograms{};
+};
+
+inline latency_probe& get_latency_probe() {
+    static latency_probe probe{};
+    return probe;
+}
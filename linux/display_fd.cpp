@@ -0,0 +1,23 @@
+#include "display_fd.hpp"
+
+// Kept out of terminal_emulator.cpp: Xlib.h defines macros such as None,
+// Bool and Status that collide with ordinary identifiers.
+#if TERMINAL_EMULATOR_X11
+#include <GLFW/glfw3.h>
+#define GLFW_EXPOSE_NATIVE_X11
+#include <GLFW/glfw3native.h>
+#endif
+
+int get_display_fd() {
+#if TERMINAL_EMULATOR_X11
+#if GLFW_VERSION_MAJOR > 3 || GLFW_VERSION_MINOR >= 4
+    if (glfwGetPlatform() != GLFW_PLATFORM_X11) {
+        return -1;
+    }
+#endif
+    if (auto display = glfwGetX11Display()) {
+        return ConnectionNumber(display);
+    }
+#endif
+    return -1;
+}
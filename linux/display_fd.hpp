@@ -0,0 +1,6 @@
+#pragma once
+
+// File descriptor of the display server connection GLFW reads its events
+// from, or -1 when it is not available (non-X11 platforms, or built without
+// X11). The descriptor stays owned by GLFW.
+int get_display_fd();
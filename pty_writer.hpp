@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "boost/asio.hpp"
+#include "utf8_encoder.hpp"
+
+// Clipboard text as the shell expects it: line breaks become CR, and with
+// bracketed paste the text is wrapped in ESC[200~ ... ESC[201~ with any
+// embedded end marker removed so the paste cannot terminate itself early.
+inline void append_paste(std::string& out, std::string_view text, bool bracketed) {
+    constexpr std::string_view paste_begin = "\x1b[200~";
+    constexpr std::string_view paste_end = "\x1b[201~";
+    if (bracketed) {
+        out += paste_begin;
+    }
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (bracketed && text.compare(i, paste_end.size(), paste_end) == 0) {
+            i += paste_end.size() - 1;
+            continue;
+        }
+        if (text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n') {
+            continue;
+        }
+        out += text[i] == '\n' ? '\r' : text[i];
+    }
+    if (bracketed) {
+        out += paste_end;
+    }
+}
+
+// Queues keyboard and paste input for the PTY and writes it asynchronously,
+// so the UI thread never blocks on a full PTY. Input is appended to the last
+// queued chunk unless that chunk is part of the write in flight, in which
+// case a new chunk is started; each write gathers every queued chunk in one
+// call. Input beyond max_pending bytes is refused until the child catches up,
+// and a write error closes the writer instead of throwing into the window
+// callbacks.
+template<class Stream>
+class pty_writer {
+public:
+    static constexpr std::size_t default_max_pending = 1024 * 1024;
+
+    pty_writer(Stream&& stream, std::size_t max_pending = default_max_pending) :
+        m_stream{ std::move(stream) }, m_max_pending{ max_pending }
+    {}
+    bool write_codepoint(uint32_t codepoint) {
+        auto& chunk = writable_chunk();
+        auto size = chunk.size();
+        append_utf8(chunk, codepoint);
+        return commit(chunk, size);
+    }
+    bool write(std::string_view bytes) {
+        auto& chunk = writable_chunk();
+        auto size = chunk.size();
+        chunk += bytes;
+        return commit(chunk, size);
+    }
+    bool paste(std::string_view text, bool bracketed) {
+        auto& chunk = writable_chunk();
+        auto size = chunk.size();
+        append_paste(chunk, text, bracketed);
+        return commit(chunk, size);
+    }
+    std::size_t get_queued_size() const {
+        return m_queued - m_front_offset;
+    }
+    bool is_closed() const {
+        return m_closed;
+    }
+private:
+    static constexpr std::size_t max_gathered_chunks = 16;
+
+    std::string& writable_chunk() {
+        if (m_chunks.size() <= m_chunks_in_flight) {
+            m_chunks.emplace_back();
+        }
+        return m_chunks.back();
+    }
+    // Keeps the bytes appended to chunk since size, or drops them if they
+    // would exceed the limit.
+    bool commit(std::string& chunk, std::size_t size) {
+        auto added = chunk.size() - size;
+        if (m_closed || get_queued_size() + added > m_max_pending) {
+            chunk.resize(size);
+            return false;
+        }
+        m_queued += added;
+        start_write();
+        return true;
+    }
+    void start_write() {
+        if (m_chunks_in_flight != 0 || m_closed || get_queued_size() == 0) {
+            return;
+        }
+        auto count = std::min(m_chunks.size(), max_gathered_chunks);
+        for (std::size_t i = 0; i < count; ++i) {
+            auto offset = i == 0 ? m_front_offset : 0;
+            m_buffers[i] = boost::asio::const_buffer{ m_chunks[i].data() + offset, m_chunks[i].size() - offset };
+        }
+        m_chunks_in_flight = count;
+        m_stream.async_write_some(std::span{ m_buffers.data(), count },
+            [this](const boost::system::error_code& err, std::size_t written) {
+                write_done(err, written);
+            });
+    }
+    void write_done(const boost::system::error_code& err, std::size_t written) {
+        m_chunks_in_flight = 0;
+        if (err) {
+            m_closed = true;
+            m_chunks.clear();
+            m_queued = 0;
+            m_front_offset = 0;
+            return;
+        }
+        m_front_offset += written;
+        while (!m_chunks.empty() && m_front_offset >= m_chunks.front().size()) {
+            m_front_offset -= m_chunks.front().size();
+            m_queued -= m_chunks.front().size();
+            m_chunks.pop_front();
+        }
+        start_write();
+    }
+
+    Stream m_stream;
+    std::size_t m_max_pending;
+    std::deque<std::string> m_chunks;
+    // the operation keeps a reference to the buffer sequence until it completes
+    std::array<boost::asio::const_buffer, max_gathered_chunks> m_buffers;
+    std::size_t m_front_offset = 0;
+    std::size_t m_queued = 0;
+    std::size_t m_chunks_in_flight = 0;
+    bool m_closed = false;
+};
@@ -0,0 +1,220 @@
+#include "allocation_counter.hpp"
+#include "glyph_source.hpp"
+#include "image_writer.hpp"
+#include "software_renderer.hpp"
+#include "terminal_buffer_manager.hpp"
+#include "terminal_text_processor.hpp"
+#include "utf8_encoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Replays a recorded PTY byte stream through terminal_text_processor and
+// terminal_buffer_manager without a window or a Vulkan device.
+//
+// usage: replay_benchmark <capture> [--chunk bytes] [--repeat count]
+//                         [--render chunks] [--font file.psf] [--dump file.png|file.ppm]
+//
+// <capture> is either a raw typescript (script(1) output) or an asciinema v2
+// .cast file, whose "o" events are concatenated.
+//
+// --render draws a frame with the software renderer after every given number
+// of chunks and reports frame times. --dump writes the final frame, which
+// makes the tool usable for golden-image tests on hosts without a GPU.
+
+namespace {
+
+class none_t {};
+using headless_pass = software_renderer<add_psf_glyphs<add_box_glyphs<none_t>>>;
+
+// Decodes the JSON string starting at the opening quote at pos.
+std::string parse_json_string(const std::string& line, std::size_t& pos) {
+    std::string out;
+    auto hex4 = [&line](std::size_t at) {
+        return static_cast<uint32_t>(std::stoul(line.substr(at, 4), nullptr, 16));
+    };
+    for (++pos; pos < line.size() && line[pos] != '"'; ++pos) {
+        if (line[pos] != '\\') {
+            out += line[pos];
+            continue;
+        }
+        switch (line[++pos]) {
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u': {
+            auto codepoint = hex4(pos + 1);
+            pos += 4;
+            // a surrogate without its other half becomes U+FFFD in append_utf8
+            if (codepoint >= 0xd800 && codepoint < 0xdc00 && line.compare(pos + 1, 2, "\\u") == 0) {
+                auto low = hex4(pos + 3);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+                    pos += 6;
+                }
+            }
+            append_utf8(out, codepoint);
+            break;
+        }
+        default: out += line[pos]; break;
+        }
+    }
+    ++pos;
+    return out;
+}
+
+// Concatenates the output events of an asciinema v2 recording:
+// a header object followed by one [time, "o", "data"] array per line.
+std::string load_asciinema(std::ifstream& file) {
+    std::string stream;
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        auto pos = line.find('"');
+        if (pos == std::string::npos) {
+            continue;
+        }
+        auto type = parse_json_string(line, pos);
+        if (type != "o") {
+            continue;
+        }
+        pos = line.find('"', pos);
+        if (pos != std::string::npos) {
+            stream += parse_json_string(line, pos);
+        }
+    }
+    return stream;
+}
+
+std::string load_capture(const std::string& path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error{"cannot open " + path};
+    }
+    if (file.peek() == '{') {
+        return load_asciinema(file);
+    }
+    return std::string{std::istreambuf_iterator<char>{file}, {}};
+}
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (argc < 2) {
+            throw std::runtime_error{"usage: replay_benchmark <capture> [--chunk bytes] [--repeat count] "
+                "[--render chunks] [--font file.psf] [--dump file.png|file.ppm]"};
+        }
+        std::size_t chunk_size = 128;
+        std::size_t repeat = 10;
+        std::size_t render_every = 0;
+        std::string font_path;
+        std::string dump_path;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            std::string option{argv[i]};
+            std::string value{argv[i + 1]};
+            if (option == "--chunk") {
+                chunk_size = std::max<std::size_t>(std::stoul(value), 1);
+            }
+            else if (option == "--repeat") {
+                repeat = std::max<std::size_t>(std::stoul(value), 1);
+            }
+            else if (option == "--render") {
+                render_every = std::stoul(value);
+            }
+            else if (option == "--font") {
+                font_path = value;
+            }
+            else if (option == "--dump") {
+                dump_path = value;
+            }
+            else {
+                throw std::runtime_error{"unknown option " + option};
+            }
+        }
+
+        auto capture = load_capture(argv[1]);
+        if (capture.empty()) {
+            throw std::runtime_error{"capture is empty"};
+        }
+        terminal_buffer_manager buffer_manager{};
+        terminal_text_processor processor{buffer_manager};
+        headless_pass renderer{};
+        if (!font_path.empty()) {
+            renderer.load_psf_font(font_path);
+        }
+        auto render = render_every != 0 || !dump_path.empty();
+        if (render) {
+            buffer_manager.sync_render_buffer();
+            renderer.init(buffer_manager);
+            renderer.run();
+        }
+
+        auto chunks_per_pass = (capture.size() + chunk_size - 1) / chunk_size;
+        std::vector<std::chrono::nanoseconds> chunk_times;
+        chunk_times.reserve(chunks_per_pass * repeat);
+        std::vector<std::chrono::nanoseconds> frame_times;
+        std::size_t chunk_count = 0;
+        auto draw_frame = [&] {
+            auto frame_start = std::chrono::steady_clock::now();
+            buffer_manager.sync_render_buffer();
+            renderer.notify_update();
+            renderer.run();
+            frame_times.push_back(std::chrono::steady_clock::now() - frame_start);
+        };
+
+        auto allocations_before = get_allocation_count();
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t pass = 0; pass < repeat; ++pass) {
+            for (std::size_t offset = 0; offset < capture.size(); offset += chunk_size) {
+                auto chunk = std::string_view{capture}.substr(offset, chunk_size);
+                auto chunk_start = std::chrono::steady_clock::now();
+                processor.process_text(chunk);
+                chunk_times.push_back(std::chrono::steady_clock::now() - chunk_start);
+                if (render_every != 0 && ++chunk_count % render_every == 0) {
+                    draw_frame();
+                }
+            }
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+        auto allocations = get_allocation_count() - allocations_before;
+
+        auto percentile = [](std::vector<std::chrono::nanoseconds>& times, double p) {
+            std::sort(times.begin(), times.end());
+            return times[static_cast<std::size_t>(p * (times.size() - 1))].count();
+        };
+        auto megabytes = static_cast<double>(capture.size() * repeat) / (1024 * 1024);
+        std::cout << "bytes:            " << capture.size() * repeat << std::endl;
+        std::cout << "chunk size:       " << chunk_size << std::endl;
+        std::cout << "throughput:       " << megabytes / elapsed.count() << " MiB/s" << std::endl;
+        std::cout << "allocations/MiB:  " << allocations / megabytes << std::endl;
+        std::cout << "chunk p50:        " << percentile(chunk_times, 0.50) << " ns" << std::endl;
+        std::cout << "chunk p99:        " << percentile(chunk_times, 0.99) << " ns" << std::endl;
+        if (!frame_times.empty()) {
+            std::cout << "frames:           " << frame_times.size() << std::endl;
+            std::cout << "frame p50:        " << percentile(frame_times, 0.50) << " ns" << std::endl;
+            std::cout << "frame p99:        " << percentile(frame_times, 0.99) << " ns" << std::endl;
+            auto& glyphs = renderer.get_glyph_cache();
+            std::cout << "glyph hit rate:   " << glyphs.get_hit_rate() << " (" << glyphs.get_misses() << " misses, "
+                << glyphs.get_evictions() << " evictions)" << std::endl;
+        }
+        if (!dump_path.empty()) {
+            draw_frame();
+            auto writer = dump_path.ends_with(".ppm") ? write_ppm : write_png;
+            writer(dump_path, renderer.get_framebuffer_width(), renderer.get_framebuffer_height(), renderer.get_framebuffer());
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "terminal_cell.hpp"
+
+// Recycles the fixed-size cell blocks that back the hot scrollback chunk, so
+// filling and sealing chunks does not go back to the heap every time.
+class scrollback_chunk_pool {
+public:
+    static constexpr std::size_t chunk_cells = 16 * 1024;
+
+    std::unique_ptr<uint32_t[]> allocate() {
+        if (m_free.empty()) {
+            return std::make_unique_for_overwrite<uint32_t[]>(chunk_cells);
+        }
+        auto block = std::move(m_free.back());
+        m_free.pop_back();
+        return block;
+    }
+    void release(std::unique_ptr<uint32_t[]> block) {
+        if (m_free.size() < max_free_blocks) {
+            m_free.push_back(std::move(block));
+        }
+    }
+private:
+    static constexpr std::size_t max_free_blocks = 2;
+    std::vector<std::unique_ptr<uint32_t[]>> m_free;
+};
+
+// Cells are mostly ASCII, lines end in runs of blanks and the style changes
+// far less often than the character, so a cold chunk is stored as two varint
+// streams. The style indices come first as runs: their count, then a length
+// and a style index per run. The codepoints follow as tags
+// (count << 1 | is_run), each followed by either one codepoint repeated count
+// times or count literal codepoints.
+namespace scrollback_codec {
+    inline void put_varint(std::vector<uint8_t>& out, uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+    inline uint32_t get_varint(const uint8_t*& in) {
+        uint32_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            auto byte = *in++;
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+    }
+    // Calls run(length, style) for each run of cells with the same style.
+    template<class Run>
+    void for_each_style_run(std::span<const terminal_cell> cells, Run run) {
+        std::size_t i = 0;
+        while (i < cells.size()) {
+            auto style = cell_style_index(cells[i]);
+            auto run_end = i + 1;
+            while (run_end < cells.size() && cell_style_index(cells[run_end]) == style) {
+                ++run_end;
+            }
+            run(static_cast<uint32_t>(run_end - i), style);
+            i = run_end;
+        }
+    }
+    inline std::vector<uint8_t> compress(std::span<const terminal_cell> cells) {
+        constexpr std::size_t min_run = 3;
+        std::vector<uint8_t> out;
+        out.reserve(cells.size() + 16);
+        uint32_t style_runs = 0;
+        for_each_style_run(cells, [&](uint32_t, uint32_t) { ++style_runs; });
+        put_varint(out, style_runs);
+        for_each_style_run(cells, [&](uint32_t length, uint32_t style) {
+            put_varint(out, length);
+            put_varint(out, style);
+        });
+        std::size_t literal_begin = 0;
+        auto flush_literals = [&](std::size_t end) {
+            if (end == literal_begin) {
+                return;
+            }
+            put_varint(out, static_cast<uint32_t>(end - literal_begin) << 1);
+            for (auto i = literal_begin; i < end; ++i) {
+                put_varint(out, cell_codepoint(cells[i]));
+            }
+        };
+        std::size_t i = 0;
+        while (i < cells.size()) {
+            auto codepoint = cell_codepoint(cells[i]);
+            auto run_end = i + 1;
+            while (run_end < cells.size() && cell_codepoint(cells[run_end]) == codepoint) {
+                ++run_end;
+            }
+            if (run_end - i >= min_run) {
+                flush_literals(i);
+                put_varint(out, static_cast<uint32_t>(run_end - i) << 1 | 1);
+                put_varint(out, codepoint);
+                literal_begin = run_end;
+            }
+            i = run_end;
+        }
+        flush_literals(cells.size());
+        out.shrink_to_fit();
+        return out;
+    }
+    inline void decompress(const std::vector<uint8_t>& in, std::vector<terminal_cell>& cells) {
+        cells.clear();
+        auto p = in.data();
+        auto end = in.data() + in.size();
+        auto style_runs = get_varint(p);
+        auto runs = p;
+        for (uint32_t i = 0; i < style_runs; ++i) {
+            get_varint(p);
+            get_varint(p);
+        }
+        while (p != end) {
+            auto tag = get_varint(p);
+            auto count = tag >> 1;
+            if (tag & 1) {
+                cells.insert(cells.end(), count, get_varint(p));
+            }
+            else {
+                for (uint32_t i = 0; i < count; ++i) {
+                    cells.push_back(get_varint(p));
+                }
+            }
+        }
+        auto cell = cells.begin();
+        for (uint32_t i = 0; i < style_runs; ++i) {
+            auto length = get_varint(runs);
+            auto style_bits = make_cell(0, get_varint(runs));
+            for (auto last = cell + length; cell != last; ++cell) {
+                *cell |= style_bits;
+            }
+        }
+    }
+}
+
+// Lines that scrolled off the top of the screen. New lines go into a hot
+// chunk drawn from the pool; a full chunk is compressed and its block
+// returned. The oldest chunks are dropped once the memory budget is exceeded.
+// A budget of 0 keeps no lines at all.
+class scrollback {
+public:
+    explicit scrollback(std::size_t memory_budget) : m_memory_budget{memory_budget} {}
+
+    // A wrapped line continues on the next one. Lines are stored without
+    // padding to any screen width, so they can be rewrapped to a new width
+    // when read instead of being reflowed when the screen is resized.
+    void push_line(std::span<const uint32_t> line, uint32_t blank = ' ', bool wrapped = false) {
+        if (m_memory_budget == 0) {
+            return;
+        }
+        auto length = line.size();
+        while (!wrapped && length > 0 && line[length - 1] == blank) {
+            --length;
+        }
+        length = std::min(length, scrollback_chunk_pool::chunk_cells);
+        if (m_chunks.empty() || !m_chunks.back().is_hot() ||
+            m_chunks.back().used + length > scrollback_chunk_pool::chunk_cells) {
+            if (!m_chunks.empty() && m_chunks.back().is_hot()) {
+                seal(m_chunks.back());
+            }
+            m_chunks.push_back(chunk{m_first_line + m_line_count, m_pool.allocate()});
+            m_memory_usage += scrollback_chunk_pool::chunk_cells * sizeof(uint32_t);
+        }
+        auto& hot = m_chunks.back();
+        std::copy(line.begin(), line.begin() + length, hot.cells.get() + hot.used);
+        hot.used += static_cast<uint32_t>(length);
+        m_memory_usage -= hot.index_size();
+        hot.line_ends.push_back(hot.used);
+        hot.wrapped.push_back(wrapped);
+        m_memory_usage += hot.index_size();
+        ++m_line_count;
+        enforce_budget();
+    }
+    // Number of stored lines; line 0 is the oldest one still kept.
+    std::size_t size() const {
+        return m_line_count;
+    }
+    // The returned cells stay valid until the next call to get_line or
+    // push_line. Trailing blanks of unwrapped lines are not stored.
+    std::span<const uint32_t> get_line(std::size_t index) {
+        auto number = m_first_line + index;
+        auto& c = chunk_of(number);
+        auto line = number - c.first_line;
+        uint32_t begin = line == 0 ? 0 : c.line_ends[line - 1];
+        uint32_t end = c.line_ends[line];
+        if (c.is_hot()) {
+            return {c.cells.get() + begin, end - begin};
+        }
+        if (m_cached_chunk != c.first_line) {
+            scrollback_codec::decompress(c.compressed, m_cache);
+            m_cached_chunk = c.first_line;
+        }
+        return {m_cache.data() + begin, end - begin};
+    }
+    bool is_wrapped(std::size_t index) const {
+        auto number = m_first_line + index;
+        auto& c = chunk_of(number);
+        return c.wrapped[number - c.first_line];
+    }
+    std::size_t get_memory_usage() const {
+        return m_memory_usage;
+    }
+private:
+    struct chunk {
+        uint64_t first_line;
+        std::unique_ptr<uint32_t[]> cells;
+        uint32_t used = 0;
+        std::vector<uint32_t> line_ends{};
+        std::vector<bool> wrapped{};
+        std::vector<uint8_t> compressed{};
+
+        bool is_hot() const {
+            return cells != nullptr;
+        }
+        std::size_t index_size() const {
+            return line_ends.capacity() * sizeof(uint32_t) + wrapped.capacity() / 8;
+        }
+        std::size_t cold_size() const {
+            return compressed.capacity() + index_size();
+        }
+    };
+    const chunk& chunk_of(uint64_t number) const {
+        auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), number,
+            [](uint64_t n, const chunk& c) { return n < c.first_line; });
+        return *std::prev(it);
+    }
+    void seal(chunk& c) {
+        m_memory_usage -= scrollback_chunk_pool::chunk_cells * sizeof(uint32_t) + c.index_size();
+        c.compressed = scrollback_codec::compress({c.cells.get(), c.used});
+        c.line_ends.shrink_to_fit();
+        c.wrapped.shrink_to_fit();
+        m_pool.release(std::move(c.cells));
+        m_memory_usage += c.cold_size();
+    }
+    void enforce_budget() {
+        while (m_memory_usage > m_memory_budget && m_chunks.size() > 1) {
+            auto& oldest = m_chunks.front();
+            m_memory_usage -= oldest.cold_size();
+            m_line_count -= oldest.line_ends.size();
+            m_first_line += oldest.line_ends.size();
+            if (m_cached_chunk == oldest.first_line) {
+                m_cached_chunk = no_chunk;
+            }
+            m_chunks.pop_front();
+        }
+    }
+
+    static constexpr uint64_t no_chunk = ~uint64_t{0};
+    std::size_t m_memory_budget;
+    std::size_t m_memory_usage = 0;
+    scrollback_chunk_pool m_pool;
+    std::deque<chunk> m_chunks;
+    uint64_t m_first_line = 0;
+    std::size_t m_line_count = 0;
+    std::vector<uint32_t> m_cache;
+    uint64_t m_cached_chunk = no_chunk;
+};
@@ -3,19 +3,58 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <poll.h>
+#include <csignal>
 
 #include <iostream>
 #include <exception>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include "protocol.hpp"
+
+void write_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        auto ret = write(fd, data.data(), data.size());
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            throw std::runtime_error("write failed");
+        }
+        data.remove_prefix(ret);
+    }
+}
+
+void send_window_size(int socket, uint16_t channel) {
+    winsize win{};
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &win) == 0 && win.ws_col != 0 && win.ws_row != 0) {
+        write_all(socket, make_resize_frame(channel, win.ws_col, win.ws_row));
+    }
+}
 
 int main(int argc, char** argv) {
     try {
-        if (argc < 2) {
-            throw std::runtime_error("wrong arguments count");
+        // -d asks for delta frames at that rate instead of every byte the
+        // shell prints
+        int frame_rate = 0;
+        for (int option; (option = getopt(argc, argv, "d:")) != -1;) {
+            if (option != 'd') {
+                throw std::runtime_error("usage: client [-d frame rate] <host> <port> [session id]");
+            }
+            frame_rate = static_cast<int>(strtol(optarg, nullptr, 10));
+        }
+        argc -= optind - 1;
+        argv += optind - 1;
+        if (argc < 3) {
+            throw std::runtime_error("usage: client [-d frame rate] <host> <port> [session id]");
         }
         int ret = socket(PF_INET, SOCK_STREAM, 0);
         if (ret < 0) {
@@ -40,28 +79,102 @@ int main(int argc, char** argv) {
             throw std::runtime_error("connect fail");
         }
 
-        auto buffer = std::vector<char>(256);
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGWINCH);
+        sigprocmask(SIG_BLOCK, &signals, nullptr);
+        int window_changes = signalfd(-1, &signals, SFD_CLOEXEC);
+        if (window_changes < 0) {
+            throw std::runtime_error("signalfd fail");
+        }
+
+        // one session on channel 0: "new" starts a shell; "attach <id>"
+        // reconnects to one that is still running and redraws its screen
+        constexpr uint16_t channel = 0;
+        std::string command = argc > 3 ? std::string{"attach "} + argv[3] : "new";
+        write_all(socket, make_frame(channel, frame_type::control, command));
+        send_window_size(socket, channel);
+        if (frame_rate > 0) {
+            write_all(socket, make_frame(channel, frame_type::control, "delta " + std::to_string(frame_rate)));
+        }
+
+        std::string input;
+        // stdin is read past room for the frame header, so it is sent as is
+        auto buffer = std::vector<char>(frame_header_size + 64 * 1024);
         int sock = socket;
         int in = STDIN_FILENO;
 
-        auto fds = std::array<pollfd,2>{
-            pollfd{.fd = sock, .events = POLLIN},
-            pollfd{.fd = in, .events = POLLIN},
+        auto fds = std::array<pollfd,3>{
+            pollfd{.fd = sock, .events = POLLIN, .revents = 0},
+            pollfd{.fd = in, .events = POLLIN, .revents = 0},
+            pollfd{.fd = window_changes, .events = POLLIN, .revents = 0},
         };
-        while (true) {
+        // input not yet acknowledged by the server, which stops reading stdin
+        // at input_window
+        std::size_t unacked = 0;
+        // errors end the client only while there is no session to go on with
+        bool attached = false;
+        bool closed = false;
+        while (!closed) {
+            if (fds[1].fd != -1) {
+                fds[1].events = unacked < input_window ? POLLIN : 0;
+            }
             int ret = poll(fds.data(), fds.size(), -1);
-            if (ret > 0) {
-                if (fds[0].revents & POLLIN) {
-                    auto ret = recv(socket, buffer.data(), buffer.size(), 0);
-                    write(STDOUT_FILENO, buffer.data(), ret);
+            if (ret <= 0) {
+                continue;
+            }
+            if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                auto ret = recv(socket, buffer.data(), buffer.size(), 0);
+                if (ret < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (ret <= 0) {
+                    throw std::runtime_error("server closed the connection");
                 }
-                if (fds[1].revents & POLLIN) {
-                    ret = read(STDIN_FILENO, buffer.data(), buffer.size());
-                    send(socket, buffer.data(), ret, 0);
+                input.append(buffer.data(), ret);
+                auto consumed = for_each_frame(input, [&](frame_header header, std::string_view payload) {
+                    if (header.type == frame_type::data) {
+                        write_all(STDOUT_FILENO, payload);
+                    }
+                    else if (header.type == frame_type::ack) {
+                        unacked -= std::min<std::size_t>(unacked, read_ack(payload));
+                    }
+                    else if (header.type == frame_type::control) {
+                        if (payload.starts_with("error ") && !attached) {
+                            throw std::runtime_error(std::string{payload});
+                        }
+                        attached = attached || payload.starts_with("session ");
+                        if (payload == "closed") {
+                            closed = true;
+                        }
+                        else if (payload != "pong") {
+                            std::cerr << payload << std::endl;
+                        }
+                    }
+                });
+                if (consumed == std::string::npos) {
+                    throw std::runtime_error("bad frame from server");
                 }
+                input.erase(0, consumed);
+            }
+            if ((fds[1].revents & (POLLIN | POLLHUP)) && unacked < input_window) {
+                auto room = std::min(buffer.size() - frame_header_size, input_window - unacked);
+                auto ret = read(STDIN_FILENO, buffer.data() + frame_header_size, room);
+                if (ret <= 0) {
+                    fds[1].fd = -1;
+                }
+                else {
+                    write_frame_header(buffer.data(), frame_header{static_cast<uint32_t>(ret), channel, frame_type::data});
+                    write_all(socket, std::string_view{buffer.data(), frame_header_size + ret});
+                    unacked += ret;
+                }
+            }
+            if (fds[2].revents & POLLIN) {
+                signalfd_siginfo info;
+                read(window_changes, &info, sizeof(info));
+                send_window_size(socket, channel);
             }
         }
-
     }
     catch (std::exception& e) {
         std::cerr << e.what() << std::endl;
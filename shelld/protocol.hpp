@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Frames exchanged between shelld and its clients:
+//   u32 payload length | u16 channel | u8 type | payload
+// with integers in network byte order. Each channel carries one session; the
+// client picks the channel number when it opens a session on it, so one
+// connection can drive several sessions.
+//
+// control payloads are text:
+//   client: "new", "attach <session id>", "detach", "ping",
+//           "delta <frame rate>" (screen diffs instead of raw output; 0 ends)
+//   server: "session <session id>", "error <reason>", "closed", "pong"
+// resize payloads are u16 columns | u16 rows. ack payloads are a u32 count
+// of data bytes the server has written to the channel's shell since its
+// last ack; a client keeps at most input_window bytes of data on a channel
+// unacknowledged and is disconnected if it sends more.
+enum class frame_type : uint8_t {
+    data = 0,
+    resize = 1,
+    control = 2,
+    ack = 3,
+};
+
+constexpr std::size_t frame_header_size = 7;
+constexpr uint32_t max_frame_payload = 1024 * 1024;
+constexpr uint32_t input_window = 256 * 1024;
+
+struct frame_header {
+    uint32_t length;
+    uint16_t channel;
+    frame_type type;
+};
+
+inline void write_frame_header(char* out, frame_header header) {
+    out[0] = static_cast<char>(header.length >> 24);
+    out[1] = static_cast<char>(header.length >> 16);
+    out[2] = static_cast<char>(header.length >> 8);
+    out[3] = static_cast<char>(header.length);
+    out[4] = static_cast<char>(header.channel >> 8);
+    out[5] = static_cast<char>(header.channel);
+    out[6] = static_cast<char>(header.type);
+}
+
+inline frame_header read_frame_header(const char* in) {
+    auto byte = [in](int i) { return static_cast<uint32_t>(static_cast<unsigned char>(in[i])); };
+    return frame_header{
+        byte(0) << 24 | byte(1) << 16 | byte(2) << 8 | byte(3),
+        static_cast<uint16_t>(byte(4) << 8 | byte(5)),
+        static_cast<frame_type>(byte(6)),
+    };
+}
+
+inline std::string make_frame(uint16_t channel, frame_type type, std::string_view payload) {
+    std::string frame(frame_header_size, '\0');
+    write_frame_header(frame.data(), frame_header{static_cast<uint32_t>(payload.size()), channel, type});
+    frame += payload;
+    return frame;
+}
+
+inline std::string make_resize_frame(uint16_t channel, int columns, int rows) {
+    const char payload[] = {
+        static_cast<char>(columns >> 8), static_cast<char>(columns),
+        static_cast<char>(rows >> 8), static_cast<char>(rows),
+    };
+    return make_frame(channel, frame_type::resize, std::string_view{payload, sizeof(payload)});
+}
+
+inline std::pair<int, int> read_resize(std::string_view payload) {
+    if (payload.size() < 4) {
+        return {0, 0};
+    }
+    auto byte = [payload](int i) { return static_cast<int>(static_cast<unsigned char>(payload[i])); };
+    return {byte(0) << 8 | byte(1), byte(2) << 8 | byte(3)};
+}
+
+inline std::string make_ack_frame(uint16_t channel, uint32_t count) {
+    const char payload[] = {
+        static_cast<char>(count >> 24), static_cast<char>(count >> 16),
+        static_cast<char>(count >> 8), static_cast<char>(count),
+    };
+    return make_frame(channel, frame_type::ack, std::string_view{payload, sizeof(payload)});
+}
+
+inline uint32_t read_ack(std::string_view payload) {
+    if (payload.size() < 4) {
+        return 0;
+    }
+    auto byte = [payload](int i) { return static_cast<uint32_t>(static_cast<unsigned char>(payload[i])); };
+    return byte(0) << 24 | byte(1) << 16 | byte(2) << 8 | byte(3);
+}
+
+// Calls handle(header, payload) for each complete frame at the front of
+// input and returns the number of bytes they took. Returns npos if a frame
+// announces a payload over max_frame_payload.
+template<class Handle>
+std::size_t for_each_frame(std::string_view input, Handle&& handle) {
+    std::size_t offset = 0;
+    while (input.size() - offset >= frame_header_size) {
+        auto header = read_frame_header(input.data() + offset);
+        if (header.length > max_frame_payload) {
+            return std::string_view::npos;
+        }
+        if (input.size() - offset - frame_header_size < header.length) {
+            break;
+        }
+        handle(header, input.substr(offset + frame_header_size, header.length));
+        offset += frame_header_size + header.length;
+    }
+    return offset;
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "terminal_buffer_manager.hpp"
+#include "utf8_encoder.hpp"
+
+// SGR sequence that sets exactly the given style, starting from a reset.
+inline void append_style(std::string& out, const cell_style& style) {
+    out += "\x1b[0";
+    constexpr std::pair<uint16_t, const char*> attributes[] = {
+        {attribute_bold, ";1"}, {attribute_faint, ";2"}, {attribute_italic, ";3"},
+        {attribute_underline, ";4"}, {attribute_blink, ";5"}, {attribute_inverse, ";7"},
+        {attribute_hidden, ";8"}, {attribute_strikethrough, ";9"},
+    };
+    for (auto [attribute, parameter] : attributes) {
+        if (style.attributes & attribute) {
+            out += parameter;
+        }
+    }
+    auto append_color = [&out](uint32_t color, int base, int bright_base) {
+        if (color == default_color) {
+            return;
+        }
+        if (color & 0x02000000) {
+            out += ';' + std::to_string(base + 8) + ";2;" + std::to_string(color >> 16 & 0xff) + ';' +
+                std::to_string(color >> 8 & 0xff) + ';' + std::to_string(color & 0xff);
+            return;
+        }
+        auto index = color & 0xff;
+        if (index < 8) {
+            out += ';' + std::to_string(base + index);
+        }
+        else if (index < 16) {
+            out += ';' + std::to_string(bright_base + index - 8);
+        }
+        else {
+            out += ';' + std::to_string(base + 8) + ";5;" + std::to_string(index);
+        }
+    };
+    append_color(style.foreground, 30, 90);
+    append_color(style.background, 40, 100);
+    out += 'm';
+}
+
+inline void append_cursor_position(std::string& out, int x, int y) {
+    out += "\x1b[" + std::to_string(y + 1) + ';' + std::to_string(x + 1) + 'H';
+}
+
+// Appends the cells [first_column, last_column) of row y, switching style
+// only where it changes. current_style is the style index in effect before
+// and after the call. Half of a wide character whose other half was
+// overwritten is sent as a blank, as a terminal would show it, so that the
+// following cells keep their columns.
+inline void append_cells(std::string& out, terminal_buffer_manager& screen, int y,
+    int first_column, int last_column, uint32_t& current_style) {
+    auto row = screen.get_row(y);
+    auto& styles = screen.get_style_table();
+    auto& graphemes = screen.get_grapheme_table();
+    auto is_wide = [&](uint32_t codepoint) {
+        return codepoint_width(is_grapheme_id(codepoint) ? graphemes.get(codepoint)[0] : codepoint) == 2;
+    };
+    auto is_continuation = [&](int x) {
+        return x < static_cast<int>(row.size()) && cell_codepoint(row[x]) == wide_continuation;
+    };
+    for (int x = first_column; x < last_column; ++x) {
+        auto codepoint = cell_codepoint(row[x]);
+        if (codepoint == wide_continuation && x > first_column && is_wide(cell_codepoint(row[x - 1]))) {
+            continue;
+        }
+        if (codepoint == wide_continuation || (is_wide(codepoint) && !is_continuation(x + 1))) {
+            codepoint = ' ';
+        }
+        if (auto style = cell_style_index(row[x]); style != current_style) {
+            append_style(out, styles.get(style));
+            current_style = style;
+        }
+        if (is_grapheme_id(codepoint)) {
+            for (auto c : graphemes.get(codepoint)) {
+                append_utf8(out, c);
+            }
+        }
+        else {
+            append_utf8(out, codepoint);
+        }
+    }
+}
+
+// Sets or resets each of the recorded private modes whose bit is in changed.
+inline void append_private_modes(std::string& out, uint32_t modes, uint32_t changed) {
+    auto& recorded = terminal_buffer_manager::recorded_private_modes;
+    for (std::size_t i = 0; i < recorded.size(); ++i) {
+        if (changed >> i & 1) {
+            out += "\x1b[?" + std::to_string(recorded[i]) + (modes >> i & 1 ? 'h' : 'l');
+        }
+    }
+}
+
+// VT sequences that redraw the whole screen of a terminal_buffer_manager on
+// a terminal of the same size: the screen it is on, main or alternate, with
+// its cursor, current style and modes. The length depends only on the screen
+// size, however much output produced it: trailing default blanks of each row
+// are left to the initial erase.
+//
+// A terminal that is then sent the raw output also needs the state that
+// output relies on, the scrolling region and insert mode; with
+// follows_raw_output false they are left at their defaults.
+inline std::string encode_screen(terminal_buffer_manager& screen, bool follows_raw_output = true) {
+    std::string out = screen.get_alternate_screen() ? "\x1b[?1049h" : "\x1b[?1049l";
+    out += "\x1b[0m\x1b[4l\x1b[r\x1b[H\x1b[2J";
+    uint32_t current_style = 0;
+    for (int y = 0; y < screen.get_height(); ++y) {
+        auto row = screen.get_row(y);
+        auto last = std::find_if(row.rbegin(), row.rend(), [](terminal_cell cell) { return cell != ' '; }).base();
+        auto last_column = static_cast<int>(last - row.begin());
+        if (last_column == 0) {
+            continue;
+        }
+        append_cursor_position(out, 0, y);
+        append_cells(out, screen, y, 0, last_column, current_style);
+    }
+    if (auto [top, bottom] = screen.get_scrolling_region();
+        follows_raw_output && (top != 0 || bottom != screen.get_height())) {
+        out += "\x1b[" + std::to_string(top + 1) + ';' + std::to_string(bottom) + 'r';
+    }
+    if (follows_raw_output && screen.get_insert_mode()) {
+        out += "\x1b[4h";
+    }
+    append_style(out, screen.get_style());
+    auto [x, y] = screen.get_cursor();
+    append_cursor_position(out, std::min(x, screen.get_width() - 1), y);
+    out += screen.get_bracketed_paste() ? "\x1b[?2004h" : "\x1b[?2004l";
+    append_private_modes(out, screen.get_private_modes(), UINT32_MAX);
+    return out;
+}
+
+// Keeps a copy of what a client's terminal shows and encodes only what
+// changed since the last frame, so output that is overwritten between frames
+// is never sent. The screen's render-buffer damage says which spans to
+// compare; changed cells within them are sent in runs, a scroll of the
+// screen or of a band of rows is sent as line feeds when the old rows
+// reappear shifted, and blank row ends are erased instead of written.
+// Switching between the main and the alternate screen is sent as a full
+// redraw; mode changes are passed on as they are.
+class delta_encoder {
+public:
+    // A full redraw that the following frames are relative to.
+    std::string reset(terminal_buffer_manager& screen) {
+        screen.sync_render_buffer();
+        m_width = screen.get_width();
+        m_height = screen.get_height();
+        m_sent.clear();
+        for (int y = 0; y < m_height; ++y) {
+            auto row = screen.get_row(y);
+            m_sent.insert(m_sent.end(), row.begin(), row.end());
+        }
+        m_cursor = screen.get_cursor();
+        m_bracketed_paste = screen.get_bracketed_paste();
+        m_alternate_screen = screen.get_alternate_screen();
+        m_private_modes = screen.get_private_modes();
+        m_style = unknown_style;
+        return encode_screen(screen, false);
+    }
+    // VT sequences taking the client from the last frame to screen, empty if
+    // nothing it shows changed.
+    std::string encode(terminal_buffer_manager& screen) {
+        if (screen.get_width() != m_width || screen.get_height() != m_height ||
+            screen.get_alternate_screen() != m_alternate_screen) {
+            return reset(screen);
+        }
+        std::vector<std::pair<int, int>> spans(m_height, {m_width, 0});
+        for (auto [y, first_column, last_column] : screen.sync_render_buffer()) {
+            spans[y] = {std::min(spans[y].first, first_column), std::clamp(last_column, spans[y].second, m_width)};
+        }
+        std::string out;
+        encode_scroll(out, screen, spans);
+        for (int y = 0; y < m_height; ++y) {
+            if (spans[y].first < spans[y].second) {
+                encode_row(out, screen, y, spans[y].first, spans[y].second);
+            }
+        }
+        auto cursor = screen.get_cursor();
+        if (!out.empty() || cursor != m_cursor) {
+            append_cursor_position(out, std::min(cursor.first, m_width - 1), cursor.second);
+            m_cursor = cursor;
+        }
+        if (screen.get_bracketed_paste() != m_bracketed_paste) {
+            m_bracketed_paste = screen.get_bracketed_paste();
+            out += m_bracketed_paste ? "\x1b[?2004h" : "\x1b[?2004l";
+        }
+        if (auto modes = screen.get_private_modes(); modes != m_private_modes) {
+            append_private_modes(out, modes, modes ^ m_private_modes);
+            m_private_modes = modes;
+        }
+        return out;
+    }
+private:
+    static constexpr uint32_t unknown_style = UINT32_MAX;
+    // unchanged cells shorter than a cursor move are rewritten instead
+    static constexpr int max_gap = 6;
+
+    std::span<terminal_cell> sent_row(int y) {
+        return std::span{m_sent}.subspan(static_cast<std::size_t>(y) * m_width, m_width);
+    }
+    void reset_style(std::string& out) {
+        if (m_style != 0) {
+            out += "\x1b[0m";
+            m_style = 0;
+        }
+    }
+    // A scroll rewrites every row it moves, so only a band of wholly damaged
+    // rows can have scrolled. Finds the smallest shift that lines the old
+    // rows of the band up with the new ones and scrolls the client by it,
+    // within a scrolling region unless the band is the whole screen.
+    void encode_scroll(std::string& out, terminal_buffer_manager& screen, std::span<const std::pair<int, int>> spans) {
+        auto whole = [this](std::pair<int, int> span) { return span == std::pair{0, m_width}; };
+        auto first = std::find_if(spans.begin(), spans.end(), whole);
+        auto top = static_cast<int>(first - spans.begin());
+        auto bottom = static_cast<int>(std::find_if_not(first, spans.end(), whole) - spans.begin());
+        for (int shift = 1; shift < bottom - top; ++shift) {
+            bool shifted = true;
+            for (int y = top; y + shift < bottom && shifted; ++y) {
+                auto row = screen.get_row(y);
+                shifted = std::equal(row.begin(), row.end(), sent_row(y + shift).begin());
+            }
+            if (!shifted) {
+                continue;
+            }
+            reset_style(out);
+            auto region = top != 0 || bottom != m_height;
+            if (region) {
+                out += "\x1b[" + std::to_string(top + 1) + ';' + std::to_string(bottom) + 'r';
+            }
+            append_cursor_position(out, 0, bottom - 1);
+            out.append(shift, '\n');
+            if (region) {
+                out += "\x1b[r";
+            }
+            auto band_end = m_sent.begin() + static_cast<std::size_t>(bottom) * m_width;
+            std::copy(m_sent.begin() + static_cast<std::size_t>(top + shift) * m_width, band_end,
+                m_sent.begin() + static_cast<std::size_t>(top) * m_width);
+            std::fill(band_end - static_cast<std::size_t>(shift) * m_width, band_end, terminal_cell{' '});
+            return;
+        }
+    }
+    void encode_row(std::string& out, terminal_buffer_manager& screen, int y, int first_column, int last_column) {
+        auto row = screen.get_row(y);
+        auto sent = sent_row(y);
+        auto changed = [&](int x) { return row[x] != sent[x]; };
+        auto is_continuation = [](terminal_cell cell) { return cell_codepoint(cell) == wide_continuation; };
+        int x = first_column;
+        while (true) {
+            while (x < last_column && !changed(x)) {
+                ++x;
+            }
+            if (x >= last_column) {
+                return;
+            }
+            auto first = x;
+            auto last = x + 1;
+            for (x = last; x < last_column && x - last <= max_gap; ++x) {
+                if (changed(x)) {
+                    last = x + 1;
+                }
+            }
+            // never start or end inside a wide character, old or new
+            while (first > 0 && (is_continuation(row[first]) || is_continuation(sent[first]))) {
+                --first;
+            }
+            while (last < m_width && (is_continuation(row[last]) || is_continuation(sent[last]))) {
+                ++last;
+            }
+            auto blank_from = last;
+            if (last == m_width) {
+                blank_from = static_cast<int>(std::find_if(row.rbegin(), row.rend() - first,
+                    [](terminal_cell cell) { return cell != ' '; }).base() - row.begin());
+            }
+            append_cursor_position(out, first, y);
+            append_cells(out, screen, y, first, blank_from, m_style);
+            if (blank_from < last) {
+                reset_style(out);
+                out += "\x1b[K";
+            }
+            std::copy(row.begin() + first, row.begin() + last, sent.begin() + first);
+            x = std::max(x, last);
+        }
+    }
+
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<terminal_cell> m_sent;
+    std::pair<int, int> m_cursor;
+    bool m_bracketed_paste = false;
+    bool m_alternate_screen = false;
+    uint32_t m_private_modes = 0;
+    // style index the client's SGR state is in
+    uint32_t m_style = unknown_style;
+};
@@ -1,15 +1,63 @@
 #include <iostream>
 #include <vector>
 #include <cstdint>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 #include <pty.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <netinet/in.h>
 #include <netdb.h>
-#include <poll.h>
+
+#include "protocol.hpp"
+#include "screen_encoder.hpp"
+#include "terminal_text_processor.hpp"
+
+inline std::runtime_error system_error(const std::string& what) {
+    return std::runtime_error{what + ": " + strerror(errno)};
+}
+
+inline void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        throw system_error("fcntl failed");
+    }
+}
+
+inline void epoll_add(int epoll, int fd, uint32_t events, void* data) {
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = data;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+        throw system_error("epoll_ctl failed");
+    }
+}
 
 template<uint16_t PORT, typename T>
 class set_static_port : public T{
@@ -17,18 +65,35 @@ public:
     uint16_t get_port() { return PORT; }
 };
 
+// SHELLD_PORT, when set, replaces the port chosen at compile time, so that
+// a second server can run beside the usual one.
+template<typename T>
+class add_port_from_environment : public T{
+    using parent = T;
+public:
+    uint16_t get_port() {
+        if (auto port = std::getenv("SHELLD_PORT")) {
+            return static_cast<uint16_t>(std::strtol(port, nullptr, 10));
+        }
+        return parent::get_port();
+    }
+};
+
+template<unsigned COUNT, typename T>
+class set_worker_count : public T{
+public:
+    unsigned get_worker_count() { return COUNT; }
+};
+
 template<typename T>
 class add_socket_bind : public T{
     using parent = T;
 public:
     add_socket_bind() : T{} {
         m_socket = make_socket(parent::get_port());
-        if (listen(m_socket, 1) < 0) {
+        if (listen(m_socket, SOMAXCONN) < 0) {
             throw std::runtime_error("listen failed");
         }
-        sockaddr_in clientname;
-        socklen_t size;
-        m_client_socket = accept(m_socket, (struct sockaddr*)&clientname, &size);
     }
     ~add_socket_bind() {
         close(m_socket);
@@ -36,16 +101,15 @@ public:
     int get_socket() {
         return m_socket;
     }
-    int get_client_socket() {
-        return m_client_socket;
-    }
     static int make_socket(uint16_t port) {
         int sock = -1;
 
-        sock = socket(PF_INET, SOCK_STREAM, 0);
+        sock = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (sock < 0) {
             throw std::runtime_error("socket create fail");
         }
+        int reuse = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
         sockaddr_in name{};
         name.sin_family = AF_INET;
@@ -60,104 +124,1178 @@ public:
     }
 private:
     int m_socket;
-    int m_client_socket;
 };
 
-template<typename T>
-class add_pty_shell : public T {
+// A shell on its own pseudo-terminal. The master is non-blocking; closing it
+// hangs up the shell, which is reaped by the event loop on SIGCHLD.
+class pty_shell {
 public:
-    add_pty_shell() {
+    pty_shell(int width, int height) {
         int master{};
         char name[256];
         termios term{};
-            term.c_iflag,
-            term.c_oflag,
-            term.c_cflag = CLOCAL | CREAD | CS8,
-            term.c_lflag,
-            term.c_cc;
+        term.c_cflag = CLOCAL | CREAD | CS8;
+        // non-canonical reads must block for input, or the shell sees
+        // end-of-file whenever its client is slower than it
+        term.c_cc[VMIN] = 1;
         winsize win{
-            96, 102
+            .ws_row = static_cast<unsigned short>(height),
+            .ws_col = static_cast<unsigned short>(width),
+            .ws_xpixel = 0,
+            .ws_ypixel = 0,
         };
         int ret = forkpty(&master, name, &term, &win);
         if (ret == -1) {
             throw std::runtime_error("forkpty failed");
         }
         if (ret == 0) {
+            // child: the server blocks SIGCHLD for its signalfd
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigprocmask(SIG_SETMASK, &signals, nullptr);
             execl("/bin/sh", "/bin/sh", NULL);
-            // child
+            _exit(127);
         }
-        int child_pid = ret;
-        std::cout << "child pid: " << child_pid << std::endl;
-        std::cout << "pseudo-terminal name: " << name << std::endl;
         m_master = master;
-        m_child_pid = child_pid;
+        m_child_pid = ret;
+        set_nonblocking(m_master);
     }
-    ~add_pty_shell() {
-        try{
-            int status{};
-            int ret = waitpid(m_child_pid, &status, 0);
-            if (ret == -1) {
-                throw std::runtime_error("waitpid failed");
-            }
-        }
-        catch (std::exception& e) {
-            std::cerr << e.what();
-        }
+    pty_shell(const pty_shell&) = delete;
+    pty_shell& operator=(const pty_shell&) = delete;
+    ~pty_shell() {
+        close(m_master);
     }
     int get_pty_master() {
         return m_master;
     }
+    int get_child_pid() {
+        return m_child_pid;
+    }
 private:
     int m_master;
     int m_child_pid;
 };
 
+class session_worker;
+
+// Maps session ids to the worker that owns the session. Ids come from the
+// kernel's CSPRNG, so that one client can neither guess nor predict its way
+// into another's shell.
+class session_registry {
+public:
+    uint64_t add(session_worker* owner) {
+        std::lock_guard lock{m_mutex};
+        uint64_t id = 0;
+        while (id == 0 || m_owners.contains(id)) {
+            id = random_id();
+        }
+        m_owners.emplace(id, owner);
+        return id;
+    }
+    session_worker* find(uint64_t id) {
+        std::lock_guard lock{m_mutex};
+        auto it = m_owners.find(id);
+        return it == m_owners.end() ? nullptr : it->second;
+    }
+    void move(uint64_t id, session_worker* owner) {
+        std::lock_guard lock{m_mutex};
+        m_owners[id] = owner;
+    }
+    void remove(uint64_t id) {
+        std::lock_guard lock{m_mutex};
+        m_owners.erase(id);
+    }
+private:
+    static uint64_t random_id() {
+        uint64_t id;
+        auto ret = getrandom(&id, sizeof(id), 0);
+        while (ret == -1 && errno == EINTR) {
+            ret = getrandom(&id, sizeof(id), 0);
+        }
+        if (ret != sizeof(id)) {
+            throw std::runtime_error("getrandom failed");
+        }
+        return id;
+    }
+
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, session_worker*> m_owners;
+};
+
+inline std::string format_session_id(uint64_t id) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(id));
+    return text;
+}
+
+enum class endpoint_kind {
+    connection,
+    pty,
+};
+
+// What epoll reports for a registered fd. readable stays set until a read
+// returns EAGAIN, since edge-triggered epoll will not report it again.
+struct endpoint {
+    endpoint_kind kind;
+    void* owner;
+    bool readable = true;
+};
+
+// Writes as much of pending as the fd takes. Returns false on error.
+inline bool flush(int to, std::string& pending) {
+    std::size_t written = 0;
+    while (written < pending.size()) {
+        auto ret = write(to, pending.data() + written, pending.size() - written);
+        if (ret > 0) {
+            written += ret;
+        }
+        else if (errno == EINTR) {
+            continue;
+        }
+        else if (errno == EAGAIN) {
+            break;
+        }
+        else {
+            return false;
+        }
+    }
+    pending.erase(0, written);
+    return true;
+}
+
+class session;
 
+// A client connection speaking the framed protocol of protocol.hpp. Frames
+// for all of its channels are queued whole and sent in batches with one
+// sendmsg each; received bytes are parsed in place, so data payloads go to
+// the PTY straight from the receive buffer. Queued output is counted per
+// channel, which is what sessions pace their reads by.
+class connection {
+public:
+    // replies to pings are dropped while this much output is queued, so a
+    // client that does not read cannot grow the queue with them
+    static constexpr std::size_t output_limit = 1024 * 1024;
+    // frames held for a channel that waits for a handover: a window of
+    // input plus the resizes and commands sent along with it
+    static constexpr std::size_t held_input_limit = input_window + 64 * 1024;
+
+    connection(uint64_t id, int socket, std::vector<uint64_t>& unflushed) :
+        m_id{id}, m_socket{socket}, m_unflushed{unflushed}
+    {}
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+    ~connection() {
+        close(m_socket);
+    }
+    uint64_t get_id() { return m_id; }
+    int get_socket() { return m_socket; }
+    endpoint& get_endpoint() { return m_endpoint; }
+    std::unordered_map<uint16_t, session*>& get_channels() { return m_channels; }
+    // Frames received on a channel whose session is being handed over from
+    // another worker, kept whole and in order until it arrives. A channel
+    // has an entry from the request until the handover is answered.
+    std::unordered_map<uint16_t, std::string>& get_held_input() { return m_held_input; }
+    std::size_t get_output_size() { return m_output_size - m_front_offset; }
+    // Bytes of frames for channel that are queued, including one partly sent.
+    std::size_t get_queued_size(uint16_t channel) {
+        auto it = m_queued.find(channel);
+        return it == m_queued.end() ? 0 : it->second;
+    }
+
+    // Queues a complete frame. The connection is put on the worker's
+    // unflushed list, so frames queued while serving one batch of events go
+    // out together.
+    void send_frame(std::string frame) {
+        if (!m_flush_pending) {
+            m_flush_pending = true;
+            m_unflushed.push_back(m_id);
+        }
+        m_output_size += frame.size();
+        m_queued[read_frame_header(frame.data()).channel] += frame.size();
+        m_output.push_back(std::move(frame));
+    }
+    void send_control(uint16_t channel, std::string_view text) {
+        send_frame(make_frame(channel, frame_type::control, text));
+    }
+    // Sends queued frames until the socket would block. Returns false on
+    // error.
+    bool flush() {
+        m_flush_pending = false;
+        std::array<iovec, max_gathered_frames> buffers;
+        while (!m_output.empty()) {
+            auto count = std::min(m_output.size(), buffers.size());
+            for (std::size_t i = 0; i < count; ++i) {
+                auto offset = i == 0 ? m_front_offset : 0;
+                buffers[i] = iovec{m_output[i].data() + offset, m_output[i].size() - offset};
+            }
+            msghdr message{};
+            message.msg_iov = buffers.data();
+            message.msg_iovlen = count;
+            auto ret = sendmsg(m_socket, &message, MSG_NOSIGNAL);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0 && errno == EAGAIN) {
+                break;
+            }
+            if (ret < 0) {
+                return false;
+            }
+            m_front_offset += ret;
+            while (!m_output.empty() && m_front_offset >= m_output.front().size()) {
+                auto& frame = m_output.front();
+                auto queued = m_queued.find(read_frame_header(frame.data()).channel);
+                queued->second -= frame.size();
+                if (queued->second == 0) {
+                    m_queued.erase(queued);
+                }
+                m_front_offset -= frame.size();
+                m_output_size -= frame.size();
+                m_output.pop_front();
+            }
+        }
+        return true;
+    }
+    // One recvmsg scattered over the free tail of the input buffer and then
+    // overflow, so the buffer only grows when a read does not fit. Returns
+    // what recvmsg returned.
+    ssize_t receive(std::span<char> overflow) {
+        std::array<iovec, 2> buffers{
+            iovec{m_input.data() + m_input_size, m_input.size() - m_input_size},
+            iovec{overflow.data(), overflow.size()},
+        };
+        msghdr message{};
+        message.msg_iov = buffers.data();
+        message.msg_iovlen = buffers.size();
+        auto ret = recvmsg(m_socket, &message, 0);
+        if (ret <= 0) {
+            return ret;
+        }
+        auto in_place = std::min(static_cast<std::size_t>(ret), buffers[0].iov_len);
+        m_input_size += in_place;
+        if (auto spilled = ret - in_place; spilled != 0) {
+            m_input.resize(m_input_size + spilled);
+            std::copy_n(overflow.data(), spilled, m_input.data() + m_input_size);
+            m_input_size += spilled;
+            m_input.resize(m_input.capacity());
+        }
+        return ret;
+    }
+    std::string_view get_input() {
+        return {m_input.data(), m_input_size};
+    }
+    void consume_input(std::size_t count) {
+        std::copy(m_input.begin() + count, m_input.begin() + m_input_size, m_input.begin());
+        m_input_size -= count;
+    }
+private:
+    static constexpr std::size_t max_gathered_frames = 64;
+
+    uint64_t m_id;
+    int m_socket;
+    std::vector<uint64_t>& m_unflushed;
+    bool m_flush_pending = false;
+    endpoint m_endpoint{endpoint_kind::connection, this};
+    std::unordered_map<uint16_t, session*> m_channels;
+    std::unordered_map<uint16_t, std::string> m_held_input;
+    std::deque<std::string> m_output;
+    std::unordered_map<uint16_t, std::size_t> m_queued;
+    std::size_t m_output_size = 0;
+    std::size_t m_front_offset = 0;
+    std::vector<char> m_input;
+    std::size_t m_input_size = 0;
+};
+
+// A shell that outlives its client connections. Everything it prints is fed
+// through terminal_text_processor into a screen model, whether or not a
+// client is attached, so a client that attaches later is sent the current
+// screen (see encode_screen) instead of the output it missed. While attached
+// it is bound to one channel of one connection.
+//
+// Both directions are bounded. Shell output stops being read once
+// high_watermark bytes are queued on the channel and resumes when the queue
+// drains to low_watermark, so a flood is held back by the PTY and the shell
+// rather than by server memory. Client input is acknowledged with ack frames
+// as it is written to the PTY, which bounds what the client can queue to
+// input_window.
+//
+// A client can instead ask for delta frames: output is then only fed to the
+// model, and at most frame rate times a second the client is sent what
+// changed on the screen (see delta_encoder). Frames are skipped while the
+// channel is over high_watermark, which bounds the queue without pausing the
+// shell, since a later frame supersedes them.
+class session {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t high_watermark = 64 * 1024;
+    static constexpr std::size_t low_watermark = 16 * 1024;
+    // reads per pump, so that a busy shell yields to the others
+    static constexpr int max_reads = 8;
+    static constexpr int max_frame_rate = 1000;
+
+    explicit session(uint64_t id) :
+        m_id{id},
+        m_screen{0},
+        m_processor{m_screen},
+        m_shell{m_screen.get_width(), m_screen.get_height()}
+    {
+        // the terminal of a client sent the raw output answers queries such
+        // as the cursor position itself; otherwise the model answers them
+        m_processor.set_reply_fun([this](std::string_view answer) {
+            if (m_connection == nullptr || is_sending_deltas()) {
+                write_to_pty(answer, false);
+            }
+        });
+    }
+    session(const session&) = delete;
+    session& operator=(const session&) = delete;
+    ~session() {
+        detach();
+    }
+    uint64_t get_id() { return m_id; }
+    int get_pty_master() { return m_shell.get_pty_master(); }
+    endpoint& get_pty_endpoint() { return m_pty_endpoint; }
+    std::size_t get_unacked_input() { return m_unacked; }
+    // True when the last pump stopped with output left to read, only
+    // because it used up its reads.
+    bool is_runnable() {
+        return m_pty_endpoint.readable && !m_paused;
+    }
+    bool is_frame_pending() {
+        return m_frame_pending;
+    }
+    clock::time_point get_next_frame() {
+        return m_next_frame;
+    }
+    // Ends a pause once the channel has drained to low_watermark.
+    bool resume_if_drained() {
+        if (!m_paused || m_connection->get_queued_size(m_channel) > low_watermark) {
+            return false;
+        }
+        m_paused = false;
+        return true;
+    }
+
+    // Binds the session to channel of c, taking it from any other client and
+    // replacing any session on that channel, and queues the reply and the
+    // current screen.
+    void attach(connection& c, uint16_t channel) {
+        if (m_connection != &c || m_channel != channel) {
+            detach("closed");
+            if (auto it = c.get_channels().find(channel); it != c.get_channels().end()) {
+                it->second->detach();
+            }
+            m_connection = &c;
+            m_channel = channel;
+            c.get_channels()[channel] = this;
+            // input still queued came from an earlier client
+            m_queued_parts.clear();
+            if (!m_to_pty.empty()) {
+                m_queued_parts.emplace_back(m_to_pty.size(), false);
+            }
+            m_written = 0;
+        }
+        c.send_control(channel, "session " + format_session_id(m_id));
+        auto screen = is_sending_deltas() ? m_encoder.reset(m_screen) : encode_screen(m_screen);
+        c.send_frame(make_frame(channel, frame_type::data, screen));
+    }
+    // Unbinds the session from its channel, sending reason on it if given.
+    void detach(std::string_view reason = {}) {
+        if (m_connection == nullptr) {
+            return;
+        }
+        if (!reason.empty()) {
+            m_connection->send_control(m_channel, reason);
+        }
+        m_connection->get_channels().erase(m_channel);
+        m_connection = nullptr;
+        m_paused = false;
+        m_unacked = 0;
+        m_frame_interval = {};
+        m_frame_pending = false;
+    }
+    // Switches the attached client to delta frames at most rate times a
+    // second, or back to forwarded output for rate 0, starting with a full
+    // redraw either way.
+    void set_frame_rate(int rate) {
+        if (m_connection == nullptr) {
+            return;
+        }
+        m_paused = false;
+        m_frame_pending = false;
+        std::string screen;
+        if (rate > 0) {
+            m_frame_interval = std::chrono::duration_cast<clock::duration>(std::chrono::seconds{1}) /
+                std::min(rate, max_frame_rate);
+            screen = m_encoder.reset(m_screen);
+        }
+        else {
+            m_frame_interval = {};
+            screen = encode_screen(m_screen);
+        }
+        m_connection->send_frame(make_frame(m_channel, frame_type::data, screen));
+    }
+    // Sends the changes since the last frame, unless the channel is too full,
+    // in which case the frame is retried an interval later.
+    void send_delta(clock::time_point now) {
+        m_next_frame = now + m_frame_interval;
+        if (m_connection->get_queued_size(m_channel) >= high_watermark) {
+            return;
+        }
+        m_frame_pending = false;
+        if (auto delta = m_encoder.encode(m_screen); !delta.empty()) {
+            m_connection->send_frame(make_frame(m_channel, frame_type::data, delta));
+        }
+    }
+    void resize(int width, int height) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        m_screen.resize(width, height);
+        // the reflowed screen is redrawn even if the shell prints nothing
+        m_frame_pending = m_frame_pending || is_sending_deltas();
+        winsize win{
+            .ws_row = static_cast<unsigned short>(height),
+            .ws_col = static_cast<unsigned short>(width),
+            .ws_xpixel = 0,
+            .ws_ypixel = 0,
+        };
+        ioctl(get_pty_master(), TIOCSWINSZ, &win);
+    }
+    // Writes input from the attached client to the shell. Returns false once
+    // the shell is gone.
+    bool write_input(std::string_view input) {
+        m_unacked += input.size();
+        if (!write_to_pty(input, true)) {
+            return false;
+        }
+        send_ack();
+        return true;
+    }
+    // Writes queued input and reads shell output until the PTY would block,
+    // the channel reaches high_watermark or max_reads are done. Returns false
+    // once the shell exits. Attached, output is read into spare_frame, which
+    // is only given away, and so only reallocated, when it is queued whole.
+    bool pump(std::span<char> buffer, std::string& spare_frame) {
+        auto queued = m_to_pty.size();
+        if (!flush(get_pty_master(), m_to_pty)) {
+            return false;
+        }
+        m_written += take_written(queued - m_to_pty.size());
+        send_ack();
+        auto forwarding = m_connection != nullptr && !is_sending_deltas();
+        for (int reads = 0; m_pty_endpoint.readable && !m_paused && reads < max_reads; ++reads) {
+            if (forwarding && m_connection->get_queued_size(m_channel) >= high_watermark) {
+                m_paused = true;
+                break;
+            }
+            // attached, the read lands in the payload of the frame that is
+            // queued, which the model is then fed from
+            auto target = buffer;
+            if (forwarding) {
+                if (spare_frame.size() != frame_header_size + buffer.size()) {
+                    spare_frame.resize_and_overwrite(frame_header_size + buffer.size(), [](char*, std::size_t size) { return size; });
+                }
+                target = std::span{spare_frame}.subspan(frame_header_size);
+            }
+            auto ret = read(get_pty_master(), target.data(), target.size());
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0 && errno == EAGAIN) {
+                m_pty_endpoint.readable = false;
+                break;
+            }
+            if (ret <= 0) {
+                // EIO on the master once the shell has exited
+                return false;
+            }
+            auto output = std::string_view{target.data(), static_cast<std::size_t>(ret)};
+            m_processor.process_text(output);
+            m_frame_pending = m_frame_pending || is_sending_deltas();
+            if (forwarding) {
+                if (static_cast<std::size_t>(ret) < buffer.size() / 4) {
+                    // a short read, such as an echo, would pin the whole
+                    // buffer while queued
+                    m_connection->send_frame(make_frame(m_channel, frame_type::data, output));
+                }
+                else {
+                    spare_frame.resize(frame_header_size + ret);
+                    write_frame_header(spare_frame.data(), frame_header{static_cast<uint32_t>(ret), m_channel, frame_type::data});
+                    m_connection->send_frame(std::exchange(spare_frame, {}));
+                }
+            }
+        }
+        return true;
+    }
+private:
+    bool is_sending_deltas() {
+        return m_frame_interval != clock::duration::zero();
+    }
+    // Writes bytes to the shell, queueing what the PTY does not take. Only
+    // acknowledged bytes count towards the attached client's acks. Returns
+    // false once the shell is gone.
+    bool write_to_pty(std::string_view bytes, bool acknowledged) {
+        while (m_to_pty.empty() && !bytes.empty()) {
+            auto ret = write(get_pty_master(), bytes.data(), bytes.size());
+            if (ret > 0) {
+                bytes.remove_prefix(ret);
+                m_written += acknowledged ? ret : 0;
+            }
+            else if (errno == EAGAIN) {
+                break;
+            }
+            else if (errno != EINTR) {
+                return false;
+            }
+        }
+        if (bytes.empty()) {
+            return true;
+        }
+        m_to_pty += bytes;
+        if (!m_queued_parts.empty() && m_queued_parts.back().second == acknowledged) {
+            m_queued_parts.back().first += bytes.size();
+        }
+        else {
+            m_queued_parts.emplace_back(bytes.size(), acknowledged);
+        }
+        return true;
+    }
+    // Drops count written bytes from the front of m_queued_parts and returns
+    // how many of them are acknowledged.
+    std::size_t take_written(std::size_t count) {
+        std::size_t acknowledged = 0;
+        while (count > 0) {
+            auto& [size, is_acknowledged] = m_queued_parts.front();
+            auto part = std::min(size, count);
+            acknowledged += is_acknowledged ? part : 0;
+            size -= part;
+            count -= part;
+            if (size == 0) {
+                m_queued_parts.pop_front();
+            }
+        }
+        return acknowledged;
+    }
+    void send_ack() {
+        if (m_connection == nullptr || m_written == 0) {
+            return;
+        }
+        m_connection->send_frame(make_ack_frame(m_channel, static_cast<uint32_t>(m_written)));
+        m_unacked -= std::min(m_unacked, m_written);
+        m_written = 0;
+    }
+
+    uint64_t m_id;
+    // only the screen is sent on attach, so no scrollback is kept
+    terminal_buffer_manager m_screen;
+    terminal_text_processor m_processor;
+    pty_shell m_shell;
+    connection* m_connection = nullptr;
+    uint16_t m_channel = 0;
+    endpoint m_pty_endpoint{endpoint_kind::pty, this};
+    bool m_paused = false;
+    std::string m_to_pty;
+    // lengths of the consecutive parts of m_to_pty and whether the attached
+    // client is acknowledged for them, which it is not for the input of
+    // earlier clients and for answers to terminal queries
+    std::deque<std::pair<std::size_t, bool>> m_queued_parts;
+    // input of the attached client that is unacknowledged, and how much of
+    // it has been written since the last ack
+    std::size_t m_unacked = 0;
+    std::size_t m_written = 0;
+    delta_encoder m_encoder;
+    clock::duration m_frame_interval{};
+    clock::time_point m_next_frame{};
+    bool m_frame_pending = false;
+};
+
+// A thread with its own epoll instance serving the connections and sessions
+// it owns. fds are registered edge-triggered for input and output, so each
+// readiness change is reported once and only what changed state is served.
+// A session lives on the worker of the connection it is attached to: one
+// attached from another worker's connection is handed over to that worker.
+// Connections and handovers arrive from other threads through an
+// eventfd-signalled inbox.
+class session_worker {
+public:
+    explicit session_worker(session_registry& registry) :
+        m_registry{registry},
+        m_epoll{epoll_create1(EPOLL_CLOEXEC)},
+        m_wakeup{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+    {
+        if (m_epoll == -1 || m_wakeup == -1) {
+            throw system_error("session worker setup failed");
+        }
+        epoll_add(m_epoll, m_wakeup, EPOLLIN | EPOLLET, nullptr);
+        m_thread = std::jthread{[this](std::stop_token stop) { run(stop); }};
+    }
+    ~session_worker() {
+        m_thread.request_stop();
+        wake();
+        m_thread.join();
+        close(m_wakeup);
+        close(m_epoll);
+    }
+    // Thread safe.
+    void add_connection(int socket) {
+        {
+            std::lock_guard lock{m_inbox_mutex};
+            m_incoming.push_back(socket);
+        }
+        wake();
+    }
+    // Thread safe. Asks this worker to hand session id over to requester,
+    // which attaches it to channel of its connection connection_id.
+    void request_session(uint64_t id, session_worker& requester, uint64_t connection_id, uint16_t channel) {
+        {
+            std::lock_guard lock{m_inbox_mutex};
+            m_requests.push_back(handover{id, &requester, connection_id, channel, nullptr});
+        }
+        wake();
+    }
+    std::size_t get_session_count() {
+        return m_session_count;
+    }
+private:
+    static constexpr std::size_t buffer_size = 64 * 1024;
+    static constexpr int max_events = 64;
+    // receives per turn, so that a busy client yields to the others
+    static constexpr int max_receives = 8;
+    static constexpr uint32_t fd_events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+    // A request for a session, or its answer, which carries the session or
+    // nullptr if it is gone.
+    struct handover {
+        uint64_t session_id;
+        session_worker* requester;
+        uint64_t connection_id;
+        uint16_t channel;
+        std::unique_ptr<session> s;
+    };
+
+    void wake() {
+        uint64_t one = 1;
+        write(m_wakeup, &one, sizeof(one));
+    }
+    void deliver(handover h) {
+        {
+            std::lock_guard lock{m_inbox_mutex};
+            m_deliveries.push_back(std::move(h));
+        }
+        wake();
+    }
+    connection* find_connection(uint64_t id) {
+        auto it = m_connections.find(id);
+        return it == m_connections.end() ? nullptr : it->second.get();
+    }
+    session* find_session(uint64_t id) {
+        auto it = m_sessions.find(id);
+        return it == m_sessions.end() ? nullptr : it->second.get();
+    }
+    void read_inbox() {
+        uint64_t count;
+        read(m_wakeup, &count, sizeof(count));
+        std::vector<int> incoming;
+        std::vector<handover> deliveries;
+        std::vector<handover> requests;
+        {
+            std::lock_guard lock{m_inbox_mutex};
+            incoming.swap(m_incoming);
+            deliveries.swap(m_deliveries);
+            requests.swap(m_requests);
+        }
+        for (auto socket : incoming) {
+            auto id = ++m_last_connection_id;
+            auto& c = *(m_connections[id] = std::make_unique<connection>(id, socket, m_unflushed));
+            epoll_add(m_epoll, socket, fd_events, &c.get_endpoint());
+        }
+        // Deliveries go first: the giving worker queues a session here before
+        // it points the registry here, so a request that followed the
+        // registry finds the session.
+        for (auto& d : deliveries) {
+            adopt(std::move(d));
+        }
+        for (auto& r : requests) {
+            hand_over(std::move(r));
+        }
+    }
+    void hand_over(handover r) {
+        auto it = m_sessions.find(r.session_id);
+        if (it == m_sessions.end()) {
+            // moved on since the requester looked it up, or exited
+            auto owner = m_registry.find(r.session_id);
+            if (owner != nullptr && owner != this) {
+                owner->request_session(r.session_id, *r.requester, r.connection_id, r.channel);
+            }
+            else {
+                r.requester->deliver(std::move(r));
+            }
+            return;
+        }
+        if (r.requester == this) {
+            if (auto c = find_connection(r.connection_id)) {
+                attach(*it->second, *c, r.channel);
+                release_held_input(*c, r.channel);
+            }
+            return;
+        }
+        r.s = std::move(it->second);
+        m_sessions.erase(it);
+        --m_session_count;
+        r.s->detach("closed");
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, r.s->get_pty_master(), nullptr);
+        auto id = r.session_id;
+        auto requester = r.requester;
+        requester->deliver(std::move(r));
+        m_registry.move(id, requester);
+    }
+    void adopt(handover d) {
+        auto c = find_connection(d.connection_id);
+        if (d.s == nullptr) {
+            if (c != nullptr) {
+                c->send_control(d.channel, "error no such session");
+                release_held_input(*c, d.channel);
+            }
+            return;
+        }
+        auto& s = *(m_sessions[d.session_id] = std::move(d.s));
+        ++m_session_count;
+        s.get_pty_endpoint().readable = true;
+        epoll_add(m_epoll, s.get_pty_master(), fd_events, &s.get_pty_endpoint());
+        if (c != nullptr) {
+            attach(s, *c, d.channel);
+            release_held_input(*c, d.channel);
+        }
+    }
+    // Handles the frames held for channel now that its handover is answered.
+    // One of them may start another handover, which holds the rest again.
+    void release_held_input(connection& c, uint16_t channel) {
+        auto it = c.get_held_input().find(channel);
+        if (it == c.get_held_input().end()) {
+            return;
+        }
+        auto held = std::move(it->second);
+        c.get_held_input().erase(it);
+        bool valid = true;
+        for_each_frame(held, [&](frame_header header, std::string_view payload) {
+            valid = valid && handle_frame(c, header, payload);
+        });
+        if (!valid) {
+            close_connection(c.get_id());
+        }
+    }
+    void create_session(connection& c, uint16_t channel) {
+        auto id = m_registry.add(this);
+        try {
+            auto& s = m_sessions[id] = std::make_unique<session>(id);
+            ++m_session_count;
+            epoll_add(m_epoll, s->get_pty_master(), fd_events, &s->get_pty_endpoint());
+        }
+        catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            if (m_sessions.erase(id) != 0) {
+                --m_session_count;
+            }
+            m_registry.remove(id);
+            c.send_control(channel, "error cannot start shell");
+            return;
+        }
+        attach(*m_sessions[id], c, channel);
+    }
+    void attach(session& s, connection& c, uint16_t channel) {
+        s.attach(c, channel);
+        serve_session(s.get_id());
+    }
+    void end_session(uint64_t id) {
+        auto it = m_sessions.find(id);
+        it->second->detach("closed");
+        m_registry.remove(id);
+        m_sessions.erase(it);
+        --m_session_count;
+    }
+    void serve_session(uint64_t id) {
+        auto s = find_session(id);
+        if (s == nullptr) {
+            return;
+        }
+        if (!s->pump(m_buffer, m_spare_frame)) {
+            end_session(id);
+            return;
+        }
+        if (s->is_runnable()) {
+            m_runnable_sessions.push_back(id);
+        }
+        if (s->is_frame_pending() && std::find(m_pending_frames.begin(), m_pending_frames.end(), id) == m_pending_frames.end()) {
+            m_pending_frames.push_back(id);
+        }
+    }
+    void close_connection(uint64_t id) {
+        auto& c = *m_connections[id];
+        while (!c.get_channels().empty()) {
+            c.get_channels().begin()->second->detach();
+        }
+        m_connections.erase(id);
+    }
+    void handle_control(connection& c, uint16_t channel, session* s, std::string_view command) {
+        constexpr std::string_view attach_command = "attach ";
+        constexpr std::string_view delta_command = "delta ";
+        if (command == "new") {
+            create_session(c, channel);
+        }
+        else if (command.starts_with(attach_command)) {
+            auto id_text = command.substr(attach_command.size());
+            uint64_t id = 0;
+            std::from_chars(id_text.data(), id_text.data() + id_text.size(), id, 16);
+            auto owner = m_registry.find(id);
+            if (owner == nullptr) {
+                c.send_control(channel, "error no such session");
+            }
+            else if (auto local = owner == this ? find_session(id) : nullptr) {
+                attach(*local, c, channel);
+            }
+            else {
+                // a session still in this worker's inbox is requested from
+                // itself, which is answered after the inbox is adopted
+                c.get_held_input()[channel];
+                owner->request_session(id, *this, c.get_id(), channel);
+            }
+        }
+        else if (command == "detach") {
+            if (s != nullptr) {
+                s->detach("closed");
+            }
+        }
+        else if (command.starts_with(delta_command)) {
+            auto rate_text = command.substr(delta_command.size());
+            int rate = 0;
+            std::from_chars(rate_text.data(), rate_text.data() + rate_text.size(), rate);
+            if (s != nullptr) {
+                s->set_frame_rate(rate);
+            }
+            else {
+                c.send_control(channel, "error no session");
+            }
+        }
+        else if (command == "ping") {
+            if (c.get_output_size() < connection::output_limit) {
+                c.send_control(channel, "pong");
+            }
+        }
+        else {
+            c.send_control(channel, "error unknown command");
+        }
+    }
+    // Returns false if the client broke the protocol.
+    bool handle_frame(connection& c, frame_header header, std::string_view payload) {
+        if (auto held = c.get_held_input().find(header.channel); held != c.get_held_input().end()) {
+            if (held->second.size() + frame_header_size + payload.size() > connection::held_input_limit) {
+                return false;
+            }
+            held->second.append(frame_header_size, '\0');
+            write_frame_header(held->second.data() + held->second.size() - frame_header_size, header);
+            held->second += payload;
+            return true;
+        }
+        auto it = c.get_channels().find(header.channel);
+        auto s = it == c.get_channels().end() ? nullptr : it->second;
+        switch (header.type) {
+            case frame_type::data:
+                if (s != nullptr && s->get_unacked_input() + payload.size() > input_window) {
+                    return false;
+                }
+                if (s != nullptr && !s->write_input(payload)) {
+                    end_session(s->get_id());
+                }
+                break;
+            case frame_type::resize:
+                if (s != nullptr) {
+                    auto [width, height] = read_resize(payload);
+                    s->resize(width, height);
+                    serve_session(s->get_id());
+                }
+                break;
+            case frame_type::control:
+                handle_control(c, header.channel, s, payload);
+                break;
+            case frame_type::ack:
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+    // Returns false if the connection failed and was closed.
+    bool flush_connection(connection& c) {
+        if (!c.flush()) {
+            close_connection(c.get_id());
+            return false;
+        }
+        for (auto [channel, s] : c.get_channels()) {
+            if (s->resume_if_drained()) {
+                m_runnable_sessions.push_back(s->get_id());
+            }
+        }
+        return true;
+    }
+    void serve_connection(uint64_t id) {
+        auto c = find_connection(id);
+        if (c == nullptr || !flush_connection(*c)) {
+            return;
+        }
+        for (int receives = 0; c->get_endpoint().readable && receives < max_receives; ++receives) {
+            auto ret = c->receive(m_buffer);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0 && errno == EAGAIN) {
+                c->get_endpoint().readable = false;
+                break;
+            }
+            if (ret <= 0) {
+                close_connection(id);
+                return;
+            }
+            bool valid = true;
+            auto consumed = for_each_frame(c->get_input(), [&](frame_header header, std::string_view payload) {
+                valid = valid && handle_frame(*c, header, payload);
+            });
+            if (!valid || consumed == std::string_view::npos) {
+                close_connection(id);
+                return;
+            }
+            c->consume_input(consumed);
+        }
+        if (c->get_endpoint().readable) {
+            m_runnable_connections.push_back(id);
+        }
+    }
+    void flush_connections() {
+        auto unflushed = std::move(m_unflushed);
+        m_unflushed.clear();
+        for (auto id : unflushed) {
+            if (auto c = find_connection(id)) {
+                flush_connection(*c);
+            }
+        }
+    }
+    // Sends the delta frames that are due and returns how long until the
+    // next one is, or -1 if none is pending.
+    int send_frames() {
+        auto now = session::clock::now();
+        auto next = session::clock::time_point::max();
+        std::erase_if(m_pending_frames, [&](uint64_t id) {
+            auto s = find_session(id);
+            if (s == nullptr || !s->is_frame_pending()) {
+                return true;
+            }
+            if (s->get_next_frame() <= now) {
+                s->send_delta(now);
+            }
+            if (!s->is_frame_pending()) {
+                return true;
+            }
+            next = std::min(next, s->get_next_frame());
+            return false;
+        });
+        if (next == session::clock::time_point::max()) {
+            return -1;
+        }
+        return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(next - now).count());
+    }
+    // Takes the ids in runnable that are not in ready yet.
+    static void add_runnable(std::vector<uint64_t>& ready, std::vector<uint64_t>& runnable) {
+        for (auto id : runnable) {
+            if (std::find(ready.begin(), ready.end(), id) == ready.end()) {
+                ready.push_back(id);
+            }
+        }
+        runnable.clear();
+    }
+    void run(std::stop_token stop) {
+        std::array<epoll_event, max_events> events;
+        int frame_timeout = -1;
+        while (!stop.stop_requested()) {
+            // whatever used up its turn is served again right after the
+            // fds that became ready meanwhile
+            bool runnable = !m_runnable_sessions.empty() || !m_runnable_connections.empty();
+            int count = epoll_wait(m_epoll, events.data(), events.size(), runnable ? 0 : frame_timeout);
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw system_error("epoll_wait failed");
+            }
+            // Everything reported is collected before anything is served:
+            // serving can end a session or connection that a later event
+            // refers to, so both are looked up again by id.
+            bool wakeup = false;
+            std::vector<uint64_t> ready_sessions;
+            std::vector<uint64_t> ready_connections;
+            for (int i = 0; i < count; ++i) {
+                auto e = static_cast<endpoint*>(events[i].data.ptr);
+                if (e == nullptr) {
+                    wakeup = true;
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    e->readable = true;
+                }
+                if (e->kind == endpoint_kind::connection) {
+                    ready_connections.push_back(static_cast<connection*>(e->owner)->get_id());
+                }
+                else {
+                    ready_sessions.push_back(static_cast<session*>(e->owner)->get_id());
+                }
+            }
+            add_runnable(ready_sessions, m_runnable_sessions);
+            add_runnable(ready_connections, m_runnable_connections);
+            for (auto id : ready_sessions) {
+                serve_session(id);
+            }
+            for (auto id : ready_connections) {
+                serve_connection(id);
+            }
+            if (wakeup) {
+                read_inbox();
+            }
+            frame_timeout = send_frames();
+            flush_connections();
+        }
+    }
+
+    session_registry& m_registry;
+    int m_epoll;
+    int m_wakeup;
+    std::mutex m_inbox_mutex;
+    std::vector<int> m_incoming;
+    std::vector<handover> m_deliveries;
+    std::vector<handover> m_requests;
+    std::atomic<std::size_t> m_session_count = 0;
+    uint64_t m_last_connection_id = 0;
+    std::vector<uint64_t> m_unflushed;
+    std::vector<uint64_t> m_runnable_sessions;
+    std::vector<uint64_t> m_runnable_connections;
+    // sessions sending delta frames that have output not yet sent
+    std::vector<uint64_t> m_pending_frames;
+    // declared before the sessions, which detach from them when destroyed
+    std::unordered_map<uint64_t, std::unique_ptr<connection>> m_connections;
+    std::unordered_map<uint64_t, std::unique_ptr<session>> m_sessions;
+    std::vector<char> m_buffer = std::vector<char>(buffer_size);
+    // the frame the next shell output is read into, see session::pump
+    std::string m_spare_frame;
+    std::jthread m_thread;
+};
+
+template<typename T>
+class add_session_workers : public T {
+    using parent = T;
+public:
+    add_session_workers() {
+        // blocked before any thread starts so that only the signalfd sees it
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &signals, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+        for (unsigned i = 0; i < parent::get_worker_count(); ++i) {
+            m_workers.push_back(std::make_unique<session_worker>(m_registry));
+        }
+    }
+    // The worker with the fewest sessions serves the connection, so it
+    // starts the sessions the client asks for.
+    void add_client(int client) {
+        auto worker = std::min_element(m_workers.begin(), m_workers.end(),
+            [](auto& a, auto& b) { return a->get_session_count() < b->get_session_count(); });
+        (*worker)->add_connection(client);
+    }
+private:
+    session_registry m_registry;
+    std::vector<std::unique_ptr<session_worker>> m_workers;
+};
+
+// Accepts clients on the listening socket and reaps exited shells; the
+// sessions themselves are served by the workers.
 template<typename T>
 class add_event_loop : public T {
     using parent = T;
 public:
     add_event_loop() {
+        int epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll == -1) {
+            throw system_error("epoll_create1 failed");
+        }
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        int children = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (children == -1) {
+            throw system_error("signalfd failed");
+        }
+        auto sock = parent::get_socket();
+        epoll_add(epoll, sock, EPOLLIN | EPOLLET, &sock);
+        epoll_add(epoll, children, EPOLLIN | EPOLLET, &children);
 
-        auto sock = parent::get_client_socket();
-        auto pty_master = parent::get_pty_master();
-        auto fds = std::array<pollfd,2>{
-            pollfd{.fd = sock, .events = POLLIN},
-            pollfd{.fd = pty_master, .events = POLLIN},
-        };
-        auto buffer = std::vector<char>(256);
+        std::array<epoll_event, 2> events;
         while (true) {
-            int ret = poll(fds.data(), fds.size(), -1);
-            if (ret > 0) {
-                if (fds[0].revents & POLLIN) {
-                    int ret = recv(sock, buffer.data(), buffer.size(), 0);
-                    write(STDOUT_FILENO, "socket get: ", 12);
-                    write(STDOUT_FILENO, buffer.data(), ret);
-                    write(STDOUT_FILENO, "\n", 1);
-                    write(pty_master, buffer.data(), ret);
+            int count = epoll_wait(epoll, events.data(), events.size(), -1);
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
                 }
-                if (fds[1].revents & POLLIN) {
-                    int ret = read(pty_master, buffer.data(), buffer.size());
-                    send(sock, buffer.data(), ret, 0);
+                throw system_error("epoll_wait failed");
+            }
+            for (int i = 0; i < count; ++i) {
+                if (events[i].data.ptr == &sock) {
+                    accept_clients(sock);
+                }
+                else {
+                    reap_children(children);
                 }
             }
         }
     }
+private:
+    void accept_clients(int sock) {
+        while (true) {
+            int client = accept4(sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN) {
+                    std::cerr << "accept failed: " << strerror(errno) << std::endl;
+                }
+                return;
+            }
+            parent::add_client(client);
+        }
+    }
+    void reap_children(int children) {
+        signalfd_siginfo info;
+        while (read(children, &info, sizeof(info)) == sizeof(info)) {
+        }
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {
+        }
+    }
 };
 
 struct empty_struct{};
 
 using server =
             add_event_loop<
-            add_pty_shell<
+            add_session_workers<
             add_socket_bind<
+            set_worker_count<4,
+            add_port_from_environment<
             set_static_port<10022,
             empty_struct
->>>>;
+>>>>>>;
 
 int main(void) {
     try {
-        server test_server{}; 
+        server test_server{};
     }
     catch (std::exception& e) {
         std::cerr << e.what() << std::endl;
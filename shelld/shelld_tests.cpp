@@ -0,0 +1,299 @@
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <csignal>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "protocol.hpp"
+
+// Checks of the frame protocol and, against a shelld started on a free
+// port, of several sessions driven over one connection, of several clients
+// served at once and of output held back from a client that does not read.
+// Takes the path of the shelld binary; prints each failed check and exits
+// non-zero if there was one.
+
+int failures = 0;
+
+void check(bool condition, std::string_view what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+void test_for_each_frame() {
+    auto stream = make_frame(1, frame_type::data, "abc") + make_frame(2, frame_type::control, "new");
+    std::vector<std::pair<uint16_t, std::string>> frames;
+    auto collect = [&](frame_header header, std::string_view payload) {
+        frames.emplace_back(header.channel, std::string{payload});
+    };
+
+    check(for_each_frame(std::string_view{stream}.substr(0, 5), collect) == 0 && frames.empty(),
+        "a partial header is left for the next read");
+    check(for_each_frame(std::string_view{stream}.substr(0, 9), collect) == 0 && frames.empty(),
+        "a partial payload is left for the next read");
+    auto partial = stream.size() - 2;
+    check(for_each_frame(std::string_view{stream}.substr(0, partial), collect) == frame_header_size + 3,
+        "whole frames are consumed up to a partial one");
+    check(frames.size() == 1 && frames[0] == std::pair<uint16_t, std::string>{1, "abc"},
+        "the whole frame before a partial one is handled");
+    frames.clear();
+    check(for_each_frame(stream, collect) == stream.size() && frames.size() == 2 &&
+        frames[1] == std::pair<uint16_t, std::string>{2, "new"}, "every whole frame is handled in order");
+
+    std::string oversized(frame_header_size, '\0');
+    write_frame_header(oversized.data(), frame_header{max_frame_payload + 1, 0, frame_type::data});
+    frames.clear();
+    check(for_each_frame(make_frame(0, frame_type::data, "x") + oversized, collect) == std::string_view::npos,
+        "an oversized frame is an error");
+    check(for_each_frame(std::string_view{oversized}.substr(0, 4), collect) == 0,
+        "a header is not judged before it is complete");
+}
+
+uint16_t free_port() {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in name{};
+    name.sin_family = AF_INET;
+    name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(name);
+    bind(sock, (sockaddr*)&name, sizeof(name));
+    getsockname(sock, (sockaddr*)&name, &length);
+    close(sock);
+    return ntohs(name.sin_port);
+}
+
+int connect_to(uint16_t port) {
+    sockaddr_in name{};
+    name.sin_family = AF_INET;
+    name.sin_port = htons(port);
+    name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // the server may still be starting
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(sock, (sockaddr*)&name, sizeof(name)) == 0) {
+            return sock;
+        }
+        close(sock);
+        usleep(20000);
+    }
+    return -1;
+}
+
+// What a connection received, per channel.
+struct received {
+    std::map<uint16_t, std::string> data;
+    std::map<uint16_t, std::vector<std::string>> controls;
+};
+
+// Reads frames until done(r) holds or the timeout passes.
+template<class Done>
+bool read_until(int sock, received& r, Done&& done) {
+    std::string input;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    while (!done(r)) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd fd{.fd = sock, .events = POLLIN, .revents = 0};
+        if (left.count() <= 0 || poll(&fd, 1, static_cast<int>(left.count())) <= 0) {
+            return false;
+        }
+        char buffer[4096];
+        auto ret = recv(sock, buffer, sizeof(buffer), 0);
+        if (ret <= 0) {
+            return false;
+        }
+        input.append(buffer, ret);
+        auto consumed = for_each_frame(input, [&](frame_header header, std::string_view payload) {
+            if (header.type == frame_type::data) {
+                r.data[header.channel] += payload;
+            }
+            else if (header.type == frame_type::control) {
+                r.controls[header.channel].emplace_back(payload);
+            }
+        });
+        if (consumed == std::string::npos) {
+            return false;
+        }
+        input.erase(0, consumed);
+    }
+    return true;
+}
+
+void send_all(int sock, std::string_view data) {
+    while (!data.empty()) {
+        auto ret = send(sock, data.data(), data.size(), MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return;
+        }
+        data.remove_prefix(ret);
+    }
+}
+
+// A shelld running on a free port for the length of a test.
+class shelld_process {
+public:
+    explicit shelld_process(const char* path) : m_port{free_port()} {
+        m_pid = fork();
+        if (m_pid == 0) {
+            setenv("SHELLD_PORT", std::to_string(m_port).c_str(), 1);
+            execl(path, path, nullptr);
+            _exit(127);
+        }
+    }
+    ~shelld_process() {
+        kill(m_pid, SIGTERM);
+        waitpid(m_pid, nullptr, 0);
+    }
+    // Returns -1 once the server does not accept for a while.
+    int connect() {
+        return connect_to(m_port);
+    }
+private:
+    uint16_t m_port;
+    pid_t m_pid;
+};
+
+void test_multiplexed_sessions(const char* shelld) {
+    shelld_process server{shelld};
+    int sock = server.connect();
+    check(sock != -1, "connect to shelld");
+    if (sock == -1) {
+        return;
+    }
+
+    received r;
+    send_all(sock, make_frame(1, frame_type::control, "new") + make_resize_frame(1, 80, 24) +
+        make_frame(2, frame_type::control, "new") + make_resize_frame(2, 100, 30));
+    auto has_session = [](const std::vector<std::string>& controls) {
+        return !controls.empty() && controls.front().starts_with("session ");
+    };
+    check(read_until(sock, r, [&](received& r) { return has_session(r.controls[1]) && has_session(r.controls[2]); }),
+        "both channels open a session");
+    check(r.controls[1].front() != r.controls[2].front(), "the sessions have their own ids");
+
+    // the shell expands the markers, so the echoed command line never matches
+    send_all(sock, make_frame(1, frame_type::data, "echo one-$((1+1)); stty size\n") +
+        make_frame(2, frame_type::data, "echo two-$((2+2)); stty size\n"));
+    check(read_until(sock, r, [](received& r) {
+            return r.data[1].find("24 80") != std::string::npos && r.data[2].find("30 100") != std::string::npos;
+        }), "both shells answer");
+    check(r.data[1].find("one-2") != std::string::npos && r.data[1].find("two-4") == std::string::npos,
+        "channel 1 carries only its own shell's output");
+    check(r.data[2].find("two-4") != std::string::npos && r.data[2].find("one-2") == std::string::npos,
+        "channel 2 carries only its own shell's output");
+
+    send_all(sock, make_frame(1, frame_type::control, "detach") +
+        make_frame(2, frame_type::data, "echo still-$((3+3))\n"));
+    check(read_until(sock, r, [](received& r) { return r.data[2].find("still-6") != std::string::npos; }),
+        "a session goes on after another one on the connection is detached");
+
+    close(sock);
+}
+
+// Opens a session on channel 1 and waits for its id.
+bool open_session(int sock, received& r) {
+    send_all(sock, make_frame(1, frame_type::control, "new") + make_resize_frame(1, 80, 24));
+    return read_until(sock, r, [](received& r) {
+        return !r.controls[1].empty() && r.controls[1].front().starts_with("session ");
+    });
+}
+
+void test_concurrent_connections(const char* shelld) {
+    shelld_process server{shelld};
+    int flooding = server.connect();
+    int quiet = server.connect();
+    int dropped = server.connect();
+    check(flooding != -1 && quiet != -1 && dropped != -1, "several clients connect at once");
+    if (flooding == -1 || quiet == -1 || dropped == -1) {
+        return;
+    }
+
+    received flooding_r, quiet_r, dropped_r;
+    check(open_session(flooding, flooding_r) && open_session(quiet, quiet_r) && open_session(dropped, dropped_r),
+        "every connection opens its own session");
+    check(flooding_r.controls[1].front() != quiet_r.controls[1].front(), "the connections get their own sessions");
+
+    // one client stops reading a flood and another drops mid-output; the
+    // remaining one is still served
+    send_all(flooding, make_frame(1, frame_type::data, "seq 1 3000000\n"));
+    send_all(dropped, make_frame(1, frame_type::data, "seq 1 3000000\n"));
+    usleep(200000);
+    close(dropped);
+    send_all(quiet, make_frame(1, frame_type::data, "echo quiet-$((5+5))\n"));
+    check(read_until(quiet, quiet_r, [](received& r) { return r.data[1].find("quiet-10") != std::string::npos; }),
+        "a client is answered while another one does not read");
+
+    int late = server.connect();
+    received late_r;
+    check(late != -1 && open_session(late, late_r), "a new client is accepted after one dropped");
+    send_all(late, make_frame(1, frame_type::data, "echo late-$((6+6))\n"));
+    check(read_until(late, late_r, [](received& r) { return r.data[1].find("late-12") != std::string::npos; }),
+        "the new client's session answers");
+
+    close(late);
+    close(quiet);
+    close(flooding);
+}
+
+void test_paused_output(const char* shelld) {
+    shelld_process server{shelld};
+    int sock = server.connect();
+    received r;
+    check(sock != -1 && open_session(sock, r), "open a session");
+    if (sock == -1) {
+        return;
+    }
+
+    // far more output than the socket buffers hold, then a mark of the
+    // shell having written all of it
+    auto done = "/tmp/shelld_tests_done_" + std::to_string(getpid());
+    unlink(done.c_str());
+    send_all(sock, make_frame(1, frame_type::data, "seq 1 3000000; : > " + done + "\n"));
+    for (int wait = 0; wait < 30 && access(done.c_str(), F_OK) != 0; ++wait) {
+        usleep(100000);
+    }
+    check(access(done.c_str(), F_OK) != 0, "a shell is held back while its client does not read");
+
+    auto tail_has = [](const std::string& data, std::string_view text) {
+        return std::string_view{data}.substr(data.size() - std::min<size_t>(data.size(), 4096)).find(text) !=
+            std::string_view::npos;
+    };
+    check(read_until(sock, r, [&](received& r) { return tail_has(r.data[1], "\n3000000\n"); }),
+        "all the held back output arrives once the client reads");
+    auto& data = r.data[1];
+    auto at = data.find("1\n2\n3\n");
+    bool in_order = at != std::string::npos;
+    for (int line = 1; in_order && line <= 3000000; ++line) {
+        auto expected = std::to_string(line) + "\n";
+        in_order = data.compare(at, expected.size(), expected) == 0;
+        at += expected.size();
+    }
+    check(in_order, "no output is lost or reordered across a pause");
+
+    send_all(sock, make_frame(1, frame_type::data, "echo after-$((7+7))\n"));
+    check(read_until(sock, r, [&](received& r) { return tail_has(r.data[1], "after-14"); }),
+        "the session answers after resuming");
+    check(access(done.c_str(), F_OK) == 0, "the shell finished once its output was read");
+    unlink(done.c_str());
+    close(sock);
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    test_for_each_frame();
+    if (argc > 1) {
+        test_multiplexed_sessions(argv[1]);
+        test_concurrent_connections(argv[1]);
+        test_paused_output(argv[1]);
+    }
+    return failures == 0 ? 0 : 1;
+}
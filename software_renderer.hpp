@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERMINAL_EMULATOR_SSE2 1
+#endif
+
+#include "glyph_cache.hpp"
+#include "terminal_buffer_manager.hpp"
+#include "terminal_cell.hpp"
+
+// Pixels are RGBA with R in the lowest byte.
+constexpr uint32_t rgba(uint32_t r, uint32_t g, uint32_t b) {
+    return 0xff000000 | b << 16 | g << 8 | r;
+}
+
+// The xterm 256-color palette.
+constexpr uint32_t palette_rgba(uint32_t index) {
+    constexpr uint32_t base[16][3] = {
+        {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+        {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+        {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+        {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+    };
+    if (index < 16) {
+        return rgba(base[index][0], base[index][1], base[index][2]);
+    }
+    if (index < 232) {
+        constexpr uint32_t levels[6] = {0, 95, 135, 175, 215, 255};
+        index -= 16;
+        return rgba(levels[index / 36], levels[index / 6 % 6], levels[index % 6]);
+    }
+    auto gray = 8 + 10 * (index - 232);
+    return rgba(gray, gray, gray);
+}
+
+// Blends color over count pixels of dst, weighted by 8-bit coverage:
+// dst = (dst * (255 - a) + color * a) / 255 for each channel.
+inline void blend_span(uint32_t* dst, const uint8_t* coverage, int count, uint32_t color) {
+    int i = 0;
+#if TERMINAL_EMULATOR_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto ones = _mm_set1_epi16(255);
+    const auto rounding = _mm_set1_epi16(128);
+    const auto source = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(color)), zero);
+    auto blend_half = [&](__m128i d, __m128i a) {
+        auto x = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(ones, a)), _mm_mullo_epi16(source, a));
+        x = _mm_add_epi16(x, rounding);
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+        int32_t packed;
+        std::copy(coverage + i, coverage + i + 4, reinterpret_cast<uint8_t*>(&packed));
+        if (packed == 0) {
+            continue;
+        }
+        // a0 a1 a2 a3 -> a0 a0 a0 a0 a1 a1 a1 a1 ...
+        auto a = _mm_cvtsi32_si128(packed);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+        auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        auto low = blend_half(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(a, zero));
+        auto high = blend_half(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(a, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; i < count; ++i) {
+        uint32_t a = coverage[i];
+        if (a == 0) {
+            continue;
+        }
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            auto x = (dst[i] >> shift & 0xff) * (255 - a) + (color >> shift & 0xff) * a + 128;
+            out |= ((x + (x >> 8)) >> 8) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+// Synthetic bold for glyph sources without a bold face: every pixel also
+// covers its right neighbour.
+inline void embolden(std::span<uint8_t> coverage, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        auto row = coverage.data() + y * width;
+        for (int x = width - 1; x > 0; --x) {
+            row[x] = std::max(row[x], row[x - 1]);
+        }
+    }
+}
+
+// Synthetic italic: rows are shifted right the more the higher they are, by
+// up to a quarter of the width at the top.
+inline void slant(std::span<uint8_t> coverage, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        auto row = coverage.data() + y * width;
+        auto shift = (height - 1 - y) * width / (4 * height);
+        std::copy_backward(row, row + width - shift, row + width);
+        std::fill_n(row, shift, 0);
+    }
+}
+
+// Rasterizes the cell grid of a terminal_buffer_manager into an in-memory
+// RGBA framebuffer, with the same init/notify_update/run interface as
+// renderer_presenter. The parent mixin supplies glyphs (see glyph_source.hpp),
+// which are rasterized on first use into a glyph_cache, with bold and italic
+// derived from the regular glyph. run() redraws only the cells damaged by the
+// latest sync_render_buffer().
+template<class T>
+class software_renderer : public T {
+public:
+    using parent = T;
+    void init(terminal_buffer_manager& buffer_manager) {
+        m_buffer_manager = &buffer_manager;
+        std::tie(m_cell_width, m_cell_height) = parent::get_cell_size();
+        m_width = buffer_manager.get_width() * m_cell_width;
+        m_height = buffer_manager.get_height() * m_cell_height;
+        m_pixels.assign(static_cast<std::size_t>(m_width) * m_height, m_default_background);
+        m_full_redraw = true;
+    }
+    void set_default_colors(uint32_t foreground, uint32_t background) {
+        m_default_foreground = foreground;
+        m_default_background = background;
+        m_full_redraw = true;
+    }
+    void notify_update() {
+        m_updated = true;
+    }
+    void run() {
+        if (!m_updated && !m_full_redraw) {
+            return;
+        }
+        m_updated = false;
+        if (m_full_redraw) {
+            m_full_redraw = false;
+            for (int y = 0; y < m_buffer_manager->get_height(); ++y) {
+                draw_cells(y, 0, m_buffer_manager->get_width());
+            }
+            return;
+        }
+        for (auto& span : m_buffer_manager->get_damage()) {
+            draw_cells(span.row, span.first_column, span.last_column);
+        }
+    }
+    int get_framebuffer_width() { return m_width; }
+    int get_framebuffer_height() { return m_height; }
+    std::span<const uint32_t> get_framebuffer() { return m_pixels; }
+    const glyph_cache& get_glyph_cache() { return m_glyphs; }
+private:
+    uint32_t resolve(uint32_t color, uint32_t fallback, bool bright) {
+        if (color == default_color) {
+            return fallback;
+        }
+        if (color & 0x02000000) {
+            return rgba(color >> 16 & 0xff, color >> 8 & 0xff, color & 0xff);
+        }
+        auto index = color & 0xff;
+        return palette_rgba(bright && index < 8 ? index + 8 : index);
+    }
+    // A wide character is drawn by its left cell across both cells, so a
+    // span that starts on its right half starts one cell earlier.
+    void draw_cells(int y, int first_column, int last_column) {
+        auto row = m_buffer_manager->get_row(y);
+        auto& graphemes = m_buffer_manager->get_grapheme_table();
+        auto is_wide = [&](int x) {
+            return x + 1 < static_cast<int>(row.size()) && cell_codepoint(row[x + 1]) == wide_continuation &&
+                codepoint_width(graphemes.base_codepoint(cell_codepoint(row[x]))) == 2;
+        };
+        auto [cursor_x, cursor_y] = m_buffer_manager->get_cursor();
+        cursor_x = std::min(cursor_x, m_buffer_manager->get_width() - 1);
+        if (first_column > 0 && is_wide(first_column - 1)) {
+            --first_column;
+        }
+        for (int x = first_column; x < last_column; ++x) {
+            auto columns = is_wide(x) ? 2 : 1;
+            auto cursor = y == cursor_y && cursor_x >= x && cursor_x < x + columns;
+            draw_cell(x, y, row[x], columns, cursor);
+            x += columns - 1;
+        }
+    }
+    void draw_cell(int x, int y, terminal_cell cell, int columns, bool cursor) {
+        auto& style = m_buffer_manager->get_style_table().get(cell_style_index(cell));
+        auto foreground = resolve(style.foreground, m_default_foreground, style.attributes & attribute_bold);
+        auto background = resolve(style.background, m_default_background, false);
+        if (style.attributes & attribute_faint) {
+            foreground = 0xff000000 | (foreground >> 1 & 0x7f7f7f);
+        }
+        if (static_cast<bool>(style.attributes & attribute_inverse) != cursor) {
+            std::swap(foreground, background);
+        }
+        if (style.attributes & attribute_hidden) {
+            foreground = background;
+        }
+
+        auto width = m_cell_width * columns;
+        auto origin = m_pixels.data() + static_cast<std::size_t>(y) * m_cell_height * m_width + x * m_cell_width;
+        for (int line = 0; line < m_cell_height; ++line) {
+            std::fill_n(origin + line * m_width, width, background);
+        }
+        auto codepoint = m_buffer_manager->get_grapheme_table().base_codepoint(cell_codepoint(cell));
+        if (codepoint > ' ' && codepoint != wide_continuation) {
+            auto key = glyph_key{
+                codepoint,
+                static_cast<uint16_t>(style.attributes & (attribute_bold | attribute_italic)),
+                static_cast<uint16_t>(width),
+                static_cast<uint8_t>(m_cell_height),
+            };
+            auto glyph = m_glyphs.get(key, [this, codepoint, width, &key](std::span<uint8_t> coverage) {
+                if (!parent::rasterize_glyph(codepoint, width, m_cell_height, coverage)) {
+                    return false;
+                }
+                if (key.attributes & attribute_bold) {
+                    embolden(coverage, width, m_cell_height);
+                }
+                if (key.attributes & attribute_italic) {
+                    slant(coverage, width, m_cell_height);
+                }
+                return true;
+            });
+            for (int line = 0; line < m_cell_height && glyph; ++line) {
+                blend_span(origin + line * m_width, glyph.coverage + line * glyph.stride, width, foreground);
+            }
+        }
+        if (style.attributes & attribute_underline) {
+            std::fill_n(origin + (m_cell_height - 2) * m_width, width, foreground);
+        }
+        if (style.attributes & attribute_strikethrough) {
+            std::fill_n(origin + m_cell_height / 2 * m_width, width, foreground);
+        }
+    }
+
+    terminal_buffer_manager* m_buffer_manager = nullptr;
+    int m_cell_width = 0;
+    int m_cell_height = 0;
+    int m_width = 0;
+    int m_height = 0;
+    uint32_t m_default_foreground = rgba(229, 229, 229);
+    uint32_t m_default_background = rgba(0, 0, 0);
+    std::vector<uint32_t> m_pixels;
+    glyph_cache m_glyphs;
+    bool m_updated = false;
+    bool m_full_redraw = true;
+};
@@ -0,0 +1,671 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "multidimention_array.hpp"
+#include "scrollback.hpp"
+#include "terminal_grid.hpp"
+
+#if WIN32
+#include <Windows.h>
+#endif
+
+// Copy of the visible screen handed from the ingest thread to the UI thread.
+// Rows are kept in the grid's physical order, starting at top, so a scroll
+// moves no cells. Each row carries the generation of the first snapshot that
+// had its current content: take_snapshot only copies rows newer than the
+// snapshot it overwrites, and restore_snapshot only those newer than the one
+// it applied last, after replaying the scroll in between. The style and
+// grapheme tables only grow, so they are copied incrementally.
+struct terminal_snapshot {
+    int width = 0;
+    int height = 0;
+    uint64_t generation = 0;
+    // lines scrolled up since the screen was created
+    int64_t scrolled = 0;
+    int top = 0;
+    std::vector<terminal_cell> cells;
+    std::vector<uint64_t> row_generations;
+    std::pair<int, int> cursor_pos;
+    bool bracketed_paste = false;
+    std::vector<cell_style> styles;
+    std::vector<std::u32string> graphemes;
+};
+
+class terminal_buffer_manager {
+public:
+    static constexpr std::size_t default_scrollback_budget = 64 * 1024 * 1024;
+    // DEC private modes that change only how the terminal in front of the
+    // user behaves: cursor keys, cursor blink and visibility, and mouse
+    // reporting. They are just recorded, as bits of get_private_modes() in
+    // this order, so that another terminal can be put in the same state.
+    static constexpr std::array<uint16_t, 11> recorded_private_modes = {
+        1, 9, 12, 25, 1000, 1002, 1003, 1004, 1005, 1006, 1015,
+    };
+    static constexpr uint32_t default_private_modes = 1 << 3;
+
+    explicit terminal_buffer_manager(std::size_t scrollback_budget = default_scrollback_budget) :
+        m_buffer{ 82, 32 }, m_grid{ 82, 32 }, m_inactive_grid{ 0, 0 }, m_scrollback{ scrollback_budget }
+    {
+        m_scroll_bottom = get_height();
+    }
+  // The codepoints handed to the renderer. They only change in sync_render_buffer().
+  auto &get_buffer() { return m_buffer; }
+  auto &get_scrollback() { return m_scrollback; }
+  // Logical row y of the screen as packed cells.
+  std::span<const terminal_cell> get_row(int y) { return m_grid.row(y); }
+  const auto &get_style_table() { return m_styles; }
+  const auto &get_grapheme_table() { return m_graphemes; }
+  // Returns the cells of the render buffer that changed, including the old
+  // and new cursor cells when the cursor moved.
+  std::span<const damage_span> sync_render_buffer() {
+      m_damage.clear();
+      m_grid.sync_to(m_buffer, [this](terminal_cell cell) -> uint32_t {
+          auto codepoint = cell_codepoint(cell);
+          return codepoint == wide_continuation ? ' ' : m_graphemes.base_codepoint(codepoint);
+      }, m_damage);
+      auto cursor = std::pair{ cursor_column(), m_cursor_pos.second };
+      if (cursor != m_rendered_cursor_pos) {
+          m_damage.push_back(damage_span{ m_rendered_cursor_pos.second, m_rendered_cursor_pos.first, m_rendered_cursor_pos.first + 1 });
+          m_damage.push_back(damage_span{ cursor.second, cursor.first, cursor.first + 1 });
+          m_rendered_cursor_pos = cursor;
+      }
+      return m_damage;
+  }
+  std::span<const damage_span> get_damage() { return m_damage; }
+  void take_snapshot(terminal_snapshot& snapshot) {
+      ++m_snapshot_generation;
+      m_row_generations.resize(get_height());
+      m_scrolled += m_grid.take_changes([this](int p) { m_row_generations[p] = m_snapshot_generation; });
+      auto full = snapshot.width != get_width() || snapshot.height != get_height() || snapshot.generation == 0;
+      snapshot.width = get_width();
+      snapshot.height = get_height();
+      snapshot.cells.resize(m_buffer.size());
+      for (int p = 0; p < get_height(); ++p) {
+          if (full || m_row_generations[p] > snapshot.generation) {
+              auto row = m_grid.stored_row(p);
+              std::copy(row.begin(), row.end(), snapshot.cells.begin() + static_cast<std::size_t>(p) * get_width());
+          }
+      }
+      snapshot.generation = m_snapshot_generation;
+      snapshot.scrolled = m_scrolled;
+      snapshot.top = m_grid.get_top();
+      snapshot.row_generations = m_row_generations;
+      snapshot.cursor_pos = m_cursor_pos;
+      snapshot.bracketed_paste = m_bracketed_paste;
+      auto& styles = m_styles.get_styles();
+      snapshot.styles.insert(snapshot.styles.end(), styles.begin() + snapshot.styles.size(), styles.end());
+      auto& graphemes = m_graphemes.get_clusters();
+      snapshot.graphemes.insert(snapshot.graphemes.end(), graphemes.begin() + snapshot.graphemes.size(), graphemes.end());
+  }
+  // A scroll of less than a screen since the last restore is replayed on
+  // the grid, so the render buffer gets it as one block move.
+  void restore_snapshot(const terminal_snapshot& snapshot) {
+      auto full = m_restored_generation == 0;
+      if (snapshot.width != get_width() || snapshot.height != get_height()) {
+          reset_size(snapshot.width, snapshot.height);
+          full = true;
+      }
+      assert(snapshot.cells.size() == m_buffer.size());
+      auto shift = snapshot.scrolled - m_restored_scrolled;
+      if (!full && shift < get_height() && shift > -get_height()) {
+          for (auto i = shift; i > 0; --i) {
+              m_grid.scroll_up(m_blank);
+          }
+          for (auto i = shift; i < 0; ++i) {
+              m_grid.scroll_down(m_blank);
+          }
+      }
+      for (int y = 0; y < get_height(); ++y) {
+          auto p = (snapshot.top + y) % get_height();
+          if (!full && snapshot.row_generations[p] <= m_restored_generation) {
+              continue;
+          }
+          auto in = snapshot.cells.begin() + static_cast<std::size_t>(p) * get_width();
+          auto current = m_grid.row(y);
+          auto [first, unused] = std::mismatch(current.begin(), current.end(), in);
+          if (first == current.end()) {
+              continue;
+          }
+          auto last = std::mismatch(current.rbegin(), current.rend(), std::make_reverse_iterator(in + get_width())).first.base();
+          auto first_column = static_cast<int>(first - current.begin());
+          auto last_column = static_cast<int>(last - current.begin());
+          auto row = m_grid.modify_row(y, first_column, last_column);
+          std::copy(in + first_column, in + last_column, row.begin() + first_column);
+      }
+      m_restored_generation = snapshot.generation;
+      m_restored_scrolled = snapshot.scrolled;
+      m_cursor_pos = snapshot.cursor_pos;
+      m_bracketed_paste = snapshot.bracketed_paste;
+      m_styles.update_from(snapshot.styles);
+      m_graphemes.update_from(snapshot.graphemes);
+  }
+  void clear() {
+    set_alternate_screen(false);
+    m_bracketed_paste = false;
+    m_insert_mode = false;
+    m_private_modes = default_private_modes;
+    set_style(cell_style{});
+    m_grid.clear(m_blank);
+    m_cursor_pos = {0,0};
+    m_scroll_top = 0;
+    m_scroll_bottom = get_height();
+  }
+  const cell_style &get_style() { return m_style; }
+  // Erased cells take the background of the current style but none of its
+  // other attributes.
+  void set_style(const cell_style &style) {
+      m_style = style;
+      m_style_bits = make_cell(0, m_styles.intern(style));
+      m_blank = make_cell(' ', m_styles.intern(cell_style{ .background = style.background }));
+  }
+  // After writing the last column the cursor stays at x == width until the
+  // next character, which wraps first; a full bottom row does not scroll early.
+  void putc(uint32_t c) {
+      wrap_if_pending();
+      m_join_next = false;
+      if (m_insert_mode) {
+          insert_characters(1);
+      }
+      auto& [x, y] = m_cursor_pos;
+      m_grid.modify_row(y, x, x + 1)[x] = c | m_style_bits;
+      x += 1;
+  }
+  auto get_cursor() { return m_cursor_pos; }
+  int get_width() { return m_grid.get_width(); }
+  int get_height() { return m_grid.get_height(); }
+  void set_cursor(int x, int y) {
+      m_cursor_pos = { std::clamp(x, 0, get_width() - 1), std::clamp(y, 0, get_height() - 1) };
+  }
+  void move_cursor(int dx, int dy) {
+      set_cursor(m_cursor_pos.first + dx, m_cursor_pos.second + dy);
+  }
+  // ANSI modes (CSI n h / CSI n l) that the emulator acts on.
+  void set_mode(int mode, bool enabled) {
+      if (mode == 4) {
+          m_insert_mode = enabled;
+      }
+  }
+  // DEC private modes (CSI ? n h / CSI ? n l) that the emulator acts on.
+  void set_private_mode(int mode, bool enabled) {
+      switch (mode) {
+      case 47:
+      case 1047:
+          set_alternate_screen(enabled);
+          break;
+      case 1049:
+          if (enabled) {
+              save_cursor();
+              set_alternate_screen(true);
+          }
+          else {
+              set_alternate_screen(false);
+              restore_cursor();
+          }
+          break;
+      case 2004:
+          m_bracketed_paste = enabled;
+          break;
+      default:
+          auto it = std::find(recorded_private_modes.begin(), recorded_private_modes.end(), mode);
+          if (it != recorded_private_modes.end()) {
+              auto bit = uint32_t{1} << (it - recorded_private_modes.begin());
+              m_private_modes = enabled ? m_private_modes | bit : m_private_modes & ~bit;
+          }
+          break;
+      }
+  }
+  uint32_t get_private_modes() { return m_private_modes; }
+  bool get_bracketed_paste() { return m_bracketed_paste; }
+  bool get_insert_mode() { return m_insert_mode; }
+  bool get_alternate_screen() { return m_alternate_screen; }
+  // Switches between the main screen and the alternate one, which full
+  // screen programs draw on so that the shell's screen is left as it was.
+  // The alternate screen starts out blank and keeps no scrollback.
+  void set_alternate_screen(bool enabled) {
+      if (enabled == m_alternate_screen) {
+          return;
+      }
+      m_alternate_screen = enabled;
+      std::swap(m_grid, m_inactive_grid);
+      if (enabled) {
+          m_grid = terminal_grid{ m_inactive_grid.get_width(), m_inactive_grid.get_height() };
+          m_grid.clear(m_blank);
+      }
+      else {
+          m_grid.mark_all();
+          m_inactive_grid = terminal_grid{ 0, 0 };
+      }
+  }
+  // DECSTBM with 1-based, inclusive rows, as the parameters come; 0 stands
+  // for the screen edge. A region needs at least two rows.
+  void set_scrolling_region(int top, int bottom) {
+      top = std::max(top, 1) - 1;
+      bottom = bottom == 0 ? get_height() : std::min(bottom, get_height());
+      if (top + 1 >= bottom) {
+          return;
+      }
+      m_scroll_top = top;
+      m_scroll_bottom = bottom;
+      set_cursor(0, 0);
+  }
+  std::pair<int, int> get_scrolling_region() { return { m_scroll_top, m_scroll_bottom }; }
+  void save_cursor() { m_saved_cursor_pos = m_cursor_pos; }
+  void restore_cursor() { m_cursor_pos = m_saved_cursor_pos; }
+  // The cursor scrolls the region when it moves past its bottom, and stops
+  // at the screen edge below it.
+  void index() {
+      auto& y = m_cursor_pos.second;
+      if (y + 1 == m_scroll_bottom) {
+          scroll_up();
+      }
+      else if (y + 1 < get_height()) {
+          ++y;
+      }
+  }
+  void reverse_index() {
+      auto& y = m_cursor_pos.second;
+      if (y == m_scroll_top) {
+          scroll_down();
+      }
+      else if (y > 0) {
+          --y;
+      }
+  }
+  // Scrolls the lines of the scrolling region up by count, blanking the ones
+  // at its bottom. When the region is the whole screen the grid is rotated
+  // and, on the main screen, the top lines go into the scrollback.
+  void scroll_up(int count = 1) {
+      count = std::min(count, m_scroll_bottom - m_scroll_top);
+      if (m_scroll_top == 0 && m_scroll_bottom == get_height()) {
+          for (int i = 0; i < count; ++i) {
+              if (!m_alternate_screen) {
+                  m_scrollback.push_line(m_grid.row(0), m_blank, m_grid.is_wrapped(0));
+              }
+              m_grid.scroll_up(m_blank);
+          }
+          return;
+      }
+      move_rows(m_scroll_top + count, m_scroll_bottom, m_scroll_top);
+      clear_rows(m_scroll_bottom - count, m_scroll_bottom);
+  }
+  void scroll_down(int count = 1) {
+      count = std::min(count, m_scroll_bottom - m_scroll_top);
+      if (m_scroll_top == 0 && m_scroll_bottom == get_height()) {
+          for (int i = 0; i < count; ++i) {
+              m_grid.scroll_down(m_blank);
+          }
+          return;
+      }
+      move_rows(m_scroll_top, m_scroll_bottom - count, m_scroll_top + count);
+      clear_rows(m_scroll_top, m_scroll_top + count);
+  }
+  // IL and DL: the lines from the cursor to the bottom of the scrolling
+  // region move down or up. Outside the region they do nothing.
+  void insert_lines(int count) {
+      auto y = m_cursor_pos.second;
+      if (y < m_scroll_top || y >= m_scroll_bottom) {
+          return;
+      }
+      count = std::min(count, m_scroll_bottom - y);
+      move_rows(y, m_scroll_bottom - count, y + count);
+      clear_rows(y, y + count);
+      m_cursor_pos.first = 0;
+  }
+  void delete_lines(int count) {
+      auto y = m_cursor_pos.second;
+      if (y < m_scroll_top || y >= m_scroll_bottom) {
+          return;
+      }
+      count = std::min(count, m_scroll_bottom - y);
+      move_rows(y + count, m_scroll_bottom, y);
+      clear_rows(m_scroll_bottom - count, m_scroll_bottom);
+      m_cursor_pos.first = 0;
+  }
+  void erase_in_display(int mode) {
+      auto y = m_cursor_pos.second;
+      if (mode == 0) {
+          erase_in_line(0);
+          for (int i = y + 1; i < get_height(); ++i) {
+              m_grid.clear_row(i, m_blank);
+          }
+      }
+      else if (mode == 1) {
+          for (int i = 0; i < y; ++i) {
+              m_grid.clear_row(i, m_blank);
+          }
+          erase_in_line(1);
+      }
+      else {
+          m_grid.clear(m_blank);
+      }
+  }
+  void erase_in_line(int mode) {
+      auto& [x, y] = m_cursor_pos;
+      auto first_column = 0;
+      auto last_column = get_width();
+      if (mode == 0) {
+          first_column = std::min(x, get_width());
+      }
+      else if (mode == 1) {
+          last_column = std::min(x + 1, get_width());
+      }
+      auto row = m_grid.modify_row(y, first_column, last_column);
+      std::fill(row.begin() + first_column, row.begin() + last_column, m_blank);
+  }
+  void erase_characters(int count) {
+      auto& [x, y] = m_cursor_pos;
+      auto first_column = cursor_column();
+      auto last_column = first_column + std::min(count, get_width() - first_column);
+      auto row = m_grid.modify_row(y, first_column, last_column);
+      std::fill(row.begin() + first_column, row.begin() + last_column, m_blank);
+  }
+  void insert_characters(int count) {
+      auto& [x, y] = m_cursor_pos;
+      auto row = m_grid.modify_row(y, cursor_column(), get_width());
+      auto first = row.begin() + cursor_column();
+      auto last = row.end();
+      count = std::min(count, static_cast<int>(last - first));
+      std::copy_backward(first, last - count, last);
+      std::fill(first, first + count, m_blank);
+  }
+  void delete_characters(int count) {
+      auto& [x, y] = m_cursor_pos;
+      auto row = m_grid.modify_row(y, cursor_column(), get_width());
+      auto first = row.begin() + cursor_column();
+      auto last = row.end();
+      count = std::min(count, static_cast<int>(last - first));
+      std::copy(first + count, last, first);
+      std::fill(last - count, last, m_blank);
+  }
+  void line_return() {
+      auto& [x, y] = m_cursor_pos;
+      x = 0;
+  }
+  void table_indent() {
+      auto& [x, y] = m_cursor_pos;
+      x = std::min(x/8*8+8, get_width() - 1);
+  }
+  void backspace() {
+      auto& [x, y] = m_cursor_pos;
+      if (x > 0)--x;
+      m_grid.modify_row(y, x, x + 1)[x] = m_blank;
+  }
+  void append_string(const std::string &str) {
+    auto line_begin = str.begin();
+    while (true) {
+      auto line_end = std::find(line_begin, str.end(), '\n');
+      std::string_view line{line_begin, line_end};
+      append_str_data(line);
+      if (line_end == str.end()) {
+        break;
+      }
+      line_begin = line_end + 1;
+      new_line();
+    }
+  }
+  void append_line(const std::string_view str) {
+    append_str_data(str);
+    new_line();
+  }
+  void new_line() {
+    index();
+    m_cursor_pos.first = 0;
+  }
+  // Printable ASCII: one column per byte, so whole row segments are filled at once.
+  void append_str_data(std::string_view str) {
+    auto first = str.begin();
+    auto last = str.end();
+    auto style_bits = m_style_bits;
+    m_join_next = false;
+    while (first != last) {
+      wrap_if_pending();
+      auto& [x, y] = m_cursor_pos;
+      auto leave_size = static_cast<std::size_t>(get_width() - x);
+      auto count = std::min<std::size_t>(last - first, leave_size);
+      if (m_insert_mode) {
+          insert_characters(static_cast<int>(count));
+      }
+      std::transform(first, first + count, m_grid.modify_row(y, x, x + static_cast<int>(count)).begin() + x,
+          [style_bits](char c) { return static_cast<unsigned char>(c) | style_bits; });
+      first += count;
+      x += static_cast<int>(count);
+    }
+  }
+  void append_codepoints(std::span<const uint32_t> codepoints) {
+    for (auto c : codepoints) {
+      put_codepoint(c);
+    }
+  }
+  void put_codepoint(uint32_t c) {
+      auto width = codepoint_width(c);
+      if (width == 0 || m_join_next) {
+          m_join_next = c == zero_width_joiner;
+          combine_with_previous(c);
+          return;
+      }
+      if (width == 1) {
+          putc(c);
+          return;
+      }
+      if (m_cursor_pos.first == get_width() - 1) {
+          putc(' ');
+      }
+      wrap_if_pending();
+      if (m_insert_mode) {
+          insert_characters(2);
+      }
+      auto& [x, y] = m_cursor_pos;
+      auto row = m_grid.modify_row(y, x, x + 2);
+      row[x] = c | m_style_bits;
+      row[x + 1] = wide_continuation | m_style_bits;
+      x += 2;
+  }
+  // Rewraps the lines of the screen to the new width. Rows that no longer
+  // fit above the cursor move into the scrollback, which stores lines
+  // independently of the width and so needs no reflow of its own. On the
+  // alternate screen it is the main screen that is reflowed, around the
+  // cursor saved on entry; the alternate one is cleared, since the program
+  // drawing on it redraws when told of the new size.
+  void resize(int width, int height) {
+      if (width == get_width() && height == get_height()) {
+          return;
+      }
+      if (!m_alternate_screen) {
+          reflow(width, height);
+          return;
+      }
+      std::swap(m_grid, m_inactive_grid);
+      std::swap(m_cursor_pos, m_saved_cursor_pos);
+      reflow(width, height);
+      std::swap(m_cursor_pos, m_saved_cursor_pos);
+      std::swap(m_grid, m_inactive_grid);
+      m_grid = terminal_grid{ width, height };
+  }
+#if WIN32
+  COORD get_coord() {
+      return COORD{ static_cast<int16_t>(m_buffer.get_width()), 
+          static_cast<int16_t>(m_buffer.get_height()) };
+  }
+#endif
+
+private:
+  void reflow(int width, int height) {
+      auto [lines, cursor_line, cursor_offset] = take_lines();
+      std::vector<std::vector<terminal_cell>> rows;
+      std::vector<uint8_t> wrapped;
+      std::pair<int, int> cursor{};
+      for (std::size_t i = 0; i < lines.size(); ++i) {
+          auto& line = lines[i];
+          std::size_t offset = 0;
+          do {
+              auto count = std::min<std::size_t>(width, line.size() - offset);
+              // a wide character does not straddle the right edge
+              if (count == static_cast<std::size_t>(width) && count > 1 && offset + count < line.size() &&
+                  cell_codepoint(line[offset + count]) == wide_continuation) {
+                  --count;
+              }
+              rows.emplace_back(line.begin() + offset, line.begin() + offset + count);
+              wrapped.push_back(offset + count < line.size());
+              if (i == cursor_line && cursor_offset >= offset && (cursor_offset < offset + count || !wrapped.back())) {
+                  cursor = { static_cast<int>(cursor_offset - offset), static_cast<int>(rows.size() - 1) };
+              }
+              offset += count;
+          } while (offset < line.size());
+      }
+      auto excess = std::max(0, static_cast<int>(rows.size()) - height);
+      auto pushed = std::min(excess, cursor.second);
+      for (int y = 0; y < pushed; ++y) {
+          m_scrollback.push_line(rows[y], m_blank, wrapped[y]);
+      }
+      reset_size(width, height);
+      for (int y = 0; y < height && y + pushed < static_cast<int>(rows.size()); ++y) {
+          auto& cells = rows[y + pushed];
+          std::copy(cells.begin(), cells.end(), m_grid.modify_row(y).begin());
+          m_grid.set_wrapped(y, wrapped[y + pushed]);
+      }
+      m_cursor_pos = { std::min(cursor.first, width), cursor.second - pushed };
+      m_saved_cursor_pos = { std::min(m_saved_cursor_pos.first, width - 1), std::min(m_saved_cursor_pos.second, height - 1) };
+  }
+  // Copies rows [first, last) to start at row to, in the order that keeps
+  // overlapping rows intact.
+  void move_rows(int first, int last, int to) {
+      auto copy_row = [this](int from, int to) {
+          auto source = m_grid.row(from);
+          std::copy(source.begin(), source.end(), m_grid.modify_row(to).begin());
+          m_grid.set_wrapped(to, m_grid.is_wrapped(from));
+      };
+      if (to < first) {
+          for (int y = first; y < last; ++y) {
+              copy_row(y, to + y - first);
+          }
+      }
+      else {
+          for (int y = last - 1; y >= first; --y) {
+              copy_row(y, to + y - first);
+          }
+      }
+  }
+  void clear_rows(int first, int last) {
+      for (int y = first; y < last; ++y) {
+          m_grid.clear_row(y, m_blank);
+      }
+  }
+  void wrap_if_pending() {
+      if (m_cursor_pos.first >= get_width()) {
+          m_grid.set_wrapped(m_cursor_pos.second, true);
+          m_cursor_pos.first = 0;
+          index();
+      }
+  }
+  // Replaces the screen with a blank one of the given size.
+  void reset_size(int width, int height) {
+      m_grid = terminal_grid{ width, height };
+      m_buffer = multidimention_vector<uint32_t>{ static_cast<std::size_t>(width), static_cast<std::size_t>(height) };
+      m_rendered_cursor_pos = { 0, 0 };
+      m_cursor_pos = { std::min(m_cursor_pos.first, width), std::min(m_cursor_pos.second, height - 1) };
+      m_scroll_top = 0;
+      m_scroll_bottom = height;
+  }
+  struct screen_lines {
+      std::vector<std::vector<terminal_cell>> lines;
+      std::size_t cursor_line;
+      std::size_t cursor_offset;
+  };
+  // The screen as logical lines, joining soft-wrapped rows, without trailing
+  // blanks after the cursor or empty lines below it.
+  screen_lines take_lines() {
+      screen_lines result{ {}, 0, 0 };
+      auto& lines = result.lines;
+      for (int y = 0; y < get_height(); ++y) {
+          if (y == 0 || !m_grid.is_wrapped(y - 1)) {
+              lines.emplace_back();
+          }
+          auto& line = lines.back();
+          if (y == m_cursor_pos.second) {
+              result.cursor_line = lines.size() - 1;
+              result.cursor_offset = line.size() + m_cursor_pos.first;
+          }
+          auto row = m_grid.row(y);
+          line.insert(line.end(), row.begin(), row.end());
+      }
+      auto is_blank = [this](terminal_cell cell) { return cell == ' ' || cell == m_blank; };
+      for (std::size_t i = 0; i < lines.size(); ++i) {
+          auto& line = lines[i];
+          auto keep = i == result.cursor_line ? result.cursor_offset : 0;
+          auto last = std::find_if_not(line.rbegin(), line.rend(), is_blank).base();
+          line.erase(line.begin() + std::max<std::size_t>(last - line.begin(), std::min(keep, line.size())), line.end());
+      }
+      while (lines.size() > result.cursor_line + 1 && lines.back().empty()) {
+          lines.pop_back();
+      }
+      return result;
+  }
+  // Appends a combining mark or joined character to the cluster in the cell
+  // before the cursor. Marks with nothing before them are dropped.
+  void combine_with_previous(uint32_t c) {
+      auto& [x, y] = m_cursor_pos;
+      auto previous = std::min(x, get_width()) - 1;
+      if (previous < 0) {
+          return;
+      }
+      auto row = m_grid.row(y);
+      if (cell_codepoint(row[previous]) == wide_continuation && previous > 0) {
+          --previous;
+      }
+      auto base = cell_codepoint(row[previous]);
+      m_cluster.clear();
+      if (is_grapheme_id(base)) {
+          m_cluster = m_graphemes.get(base);
+      }
+      else {
+          m_cluster += static_cast<char32_t>(base);
+      }
+      m_cluster += static_cast<char32_t>(c);
+      m_grid.modify_row(y, previous, previous + 1)[previous] =
+          make_cell(m_graphemes.intern(m_cluster), cell_style_index(row[previous]));
+  }
+  // The cursor column, treating a pending wrap as the last column.
+  int cursor_column() {
+      return std::min(m_cursor_pos.first, get_width() - 1);
+  }
+
+  multidimention_vector<uint32_t> m_buffer;
+  terminal_grid m_grid;
+  // the main screen while the alternate one is shown
+  terminal_grid m_inactive_grid;
+  std::pair<int, int> m_cursor_pos;
+  std::pair<int, int> m_saved_cursor_pos;
+  std::pair<int, int> m_rendered_cursor_pos;
+  std::vector<damage_span> m_damage;
+  scrollback m_scrollback;
+  style_table m_styles;
+  grapheme_table m_graphemes;
+  cell_style m_style;
+  terminal_cell m_style_bits = 0;
+  terminal_cell m_blank = ' ';
+  bool m_join_next = false;
+  bool m_bracketed_paste = false;
+  bool m_insert_mode = false;
+  bool m_alternate_screen = false;
+  uint32_t m_private_modes = default_private_modes;
+  // rows [m_scroll_top, m_scroll_bottom) scroll; the rest stay put
+  int m_scroll_top = 0;
+  int m_scroll_bottom = 0;
+  std::u32string m_cluster;
+  // take_snapshot: when each physical row last changed
+  uint64_t m_snapshot_generation = 0;
+  int64_t m_scrolled = 0;
+  std::vector<uint64_t> m_row_generations;
+  // restore_snapshot: the snapshot the screen matches
+  uint64_t m_restored_generation = 0;
+  int64_t m_restored_scrolled = 0;
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A grid cell is 32 bits: a 21-bit codepoint and an 11-bit index into the
+// screen's style_table. Values above U+10FFFF are not Unicode, so that part
+// of the codepoint field marks the right half of a wide character and refers
+// to grapheme clusters kept in a grapheme_table. Style 0 is the default
+// style, so a plain character is its own cell value.
+using terminal_cell = uint32_t;
+
+constexpr uint32_t cell_codepoint_bits = 21;
+constexpr uint32_t cell_codepoint_mask = (1u << cell_codepoint_bits) - 1;
+constexpr uint32_t max_cell_styles = 1u << (32 - cell_codepoint_bits);
+constexpr uint32_t wide_continuation = 0x110000;
+constexpr uint32_t first_grapheme_id = 0x110001;
+constexpr uint32_t zero_width_joiner = 0x200d;
+
+constexpr terminal_cell make_cell(uint32_t codepoint, uint32_t style) {
+    return codepoint | style << cell_codepoint_bits;
+}
+constexpr uint32_t cell_codepoint(terminal_cell cell) {
+    return cell & cell_codepoint_mask;
+}
+constexpr uint32_t cell_style_index(terminal_cell cell) {
+    return cell >> cell_codepoint_bits;
+}
+constexpr bool is_grapheme_id(uint32_t codepoint) {
+    return codepoint >= first_grapheme_id && codepoint <= cell_codepoint_mask;
+}
+
+// Colors are 0 for the terminal default, palette_color(i) for the 256-color
+// palette or rgb_color(r, g, b) for direct color.
+constexpr uint32_t default_color = 0;
+constexpr uint32_t palette_color(uint32_t index) {
+    return 0x01000000 | (index & 0xff);
+}
+constexpr uint32_t rgb_color(uint32_t r, uint32_t g, uint32_t b) {
+    return 0x02000000 | (r & 0xff) << 16 | (g & 0xff) << 8 | (b & 0xff);
+}
+
+enum cell_attribute : uint16_t {
+    attribute_bold = 1 << 0,
+    attribute_faint = 1 << 1,
+    attribute_italic = 1 << 2,
+    attribute_underline = 1 << 3,
+    attribute_blink = 1 << 4,
+    attribute_inverse = 1 << 5,
+    attribute_hidden = 1 << 6,
+    attribute_strikethrough = 1 << 7,
+};
+
+struct cell_style {
+    uint32_t foreground = default_color;
+    uint32_t background = default_color;
+    uint16_t attributes = 0;
+
+    bool operator==(const cell_style&) const = default;
+};
+
+// Append-only set of the distinct styles in use. intern() is called for every
+// SGR sequence, so lookups go through a fixed open-addressing index rather
+// than a node-based map. Once all max_cell_styles slots are taken, new styles
+// fall back to the default style.
+class style_table {
+public:
+    style_table() {
+        m_slots.fill(empty_slot);
+        append(cell_style{});
+    }
+    uint32_t intern(const cell_style& style) {
+        for (auto slot = hash(style); ; slot = (slot + 1) % m_slots.size()) {
+            if (m_slots[slot] == empty_slot) {
+                if (m_styles.size() == max_cell_styles) {
+                    return 0;
+                }
+                m_slots[slot] = static_cast<uint16_t>(m_styles.size());
+                m_styles.push_back(style);
+                return m_slots[slot];
+            }
+            if (m_styles[m_slots[slot]] == style) {
+                return m_slots[slot];
+            }
+        }
+    }
+    const cell_style& get(uint32_t index) const {
+        return m_styles[index];
+    }
+    const std::vector<cell_style>& get_styles() const {
+        return m_styles;
+    }
+    // Brings a copy made on another thread up to date. Entries are never
+    // removed, so only the new tail is appended.
+    void update_from(const std::vector<cell_style>& styles) {
+        for (auto i = m_styles.size(); i < styles.size(); ++i) {
+            append(styles[i]);
+        }
+    }
+private:
+    static constexpr uint16_t empty_slot = 0xffff;
+
+    static std::size_t hash(const cell_style& style) {
+        auto h = (uint64_t{style.foreground} * 0x9e3779b97f4a7c15ull) ^
+            (uint64_t{style.background} * 0xc2b2ae3d27d4eb4full) ^ style.attributes;
+        return static_cast<std::size_t>(h ^ h >> 29) % (2 * max_cell_styles);
+    }
+    void append(const cell_style& style) {
+        auto slot = hash(style);
+        while (m_slots[slot] != empty_slot) {
+            slot = (slot + 1) % m_slots.size();
+        }
+        m_slots[slot] = static_cast<uint16_t>(m_styles.size());
+        m_styles.push_back(style);
+    }
+
+    std::array<uint16_t, 2 * max_cell_styles> m_slots;
+    std::vector<cell_style> m_styles;
+};
+
+// Grapheme clusters that do not fit one codepoint: a base character followed
+// by combining marks or joined with U+200D. Each distinct cluster gets an id
+// in the spare codepoint range. When the range is exhausted only the base
+// character is kept.
+class grapheme_table {
+public:
+    uint32_t intern(std::u32string_view cluster) {
+        if (auto it = m_ids.find(cluster); it != m_ids.end()) {
+            return it->second;
+        }
+        auto id = first_grapheme_id + static_cast<uint32_t>(m_clusters.size());
+        if (!is_grapheme_id(id)) {
+            return cluster.front();
+        }
+        m_clusters.emplace_back(cluster);
+        m_ids.emplace(m_clusters.back(), id);
+        return id;
+    }
+    std::u32string_view get(uint32_t id) const {
+        return m_clusters[id - first_grapheme_id];
+    }
+    // The codepoint to draw for a cell when only one glyph fits.
+    uint32_t base_codepoint(uint32_t codepoint) const {
+        return is_grapheme_id(codepoint) ? m_clusters[codepoint - first_grapheme_id].front() : codepoint;
+    }
+    const std::vector<std::u32string>& get_clusters() const {
+        return m_clusters;
+    }
+    void update_from(const std::vector<std::u32string>& clusters) {
+        for (auto i = m_clusters.size(); i < clusters.size(); ++i) {
+            intern(clusters[i]);
+        }
+    }
+private:
+    struct cluster_hash {
+        using is_transparent = void;
+        std::size_t operator()(std::u32string_view cluster) const {
+            return std::hash<std::u32string_view>{}(cluster);
+        }
+    };
+    std::vector<std::u32string> m_clusters;
+    std::unordered_map<std::u32string, uint32_t, cluster_hash, std::equal_to<>> m_ids;
+};
+
+// Number of columns a codepoint occupies. Covers combining marks, the East
+// Asian wide and fullwidth blocks and the emoji blocks; everything else is
+// one column.
+inline int codepoint_width(uint32_t codepoint) {
+    struct range {
+        uint32_t first;
+        uint32_t last;
+    };
+    static constexpr range zero_width[] = {
+        {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x0610, 0x061a},
+        {0x064b, 0x065f}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e},
+        {0x1160, 0x11ff}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x200b, 0x200f},
+        {0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0x1f3fb, 0x1f3ff},
+        {0xe0100, 0xe01ef},
+    };
+    static constexpr range wide[] = {
+        {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+        {0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x26a1, 0x26a1},
+        {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26d4, 0x26d4},
+        {0x26ea, 0x26ea}, {0x26f5, 0x26f5}, {0x26fa, 0x26fa}, {0x26fd, 0x26fd},
+        {0x2705, 0x2705}, {0x270a, 0x270b}, {0x2728, 0x2728}, {0x274c, 0x274c},
+        {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27b0, 0x27b0},
+        {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55}, {0x2e80, 0x303e},
+        {0x3041, 0x33ff}, {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf},
+        {0xa960, 0xa97f}, {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19},
+        {0xfe30, 0xfe6f}, {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x18aff},
+        {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e},
+        {0x1f191, 0x1f19a}, {0x1f200, 0x1f2ff}, {0x1f300, 0x1f3fa}, {0x1f400, 0x1f64f},
+        {0x1f680, 0x1f6ff}, {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f9ff}, {0x1fa70, 0x1faff},
+        {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+    };
+    auto contains = [codepoint](const auto& ranges) {
+        auto it = std::upper_bound(std::begin(ranges), std::end(ranges), codepoint,
+            [](uint32_t c, const range& r) { return c < r.first; });
+        return it != std::begin(ranges) && codepoint <= std::prev(it)->last;
+    };
+    if (codepoint < 0x300) {
+        return 1;
+    }
+    if (contains(zero_width)) {
+        return 0;
+    }
+    return contains(wide) ? 2 : 1;
+}
@@ -9,10 +9,12 @@
 
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <random>
 #include <set>
 #include <strstream>
@@ -22,15 +24,25 @@
 
 #include <GLFW/glfw3.h>
 
+#include "adaptive_read_buffer.hpp"
+#include "frame_pacer.hpp"
+#include "latency_probe.hpp"
 #include "multidimention_array.hpp"
+#include "pty_writer.hpp"
 #include "run_result.hpp"
-#include "terminal_sequence_lexer.hpp"
+#include "terminal_buffer_manager.hpp"
+#include "terminal_text_processor.hpp"
+#include "trace.hpp"
+#include "triple_buffer.hpp"
 
 #if WIN32
 #include "named_pipe.hpp"
 #include <ConsoleApi.h>
 #else
+#include "linux/display_fd.hpp"
+#include <fcntl.h>
 #include <pty.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #endif
@@ -105,14 +117,37 @@ public:
     window_map.emplace(window, this);
     glfwSetCharCallback(window, character_callback);
     glfwSetKeyCallback(window, key_callback);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
   }
   auto get_glfw_window() { return window; }
+  std::pair<int, int> get_framebuffer_size() {
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    return {width, height};
+  }
+  // A drag-resize reports many sizes between two frames; only the latest is kept.
+  bool is_framebuffer_resized() { return pending_framebuffer_size.has_value(); }
+  std::optional<std::pair<int, int>> take_framebuffer_resize() {
+    return std::exchange(pending_framebuffer_size, std::nullopt);
+  }
+  static void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+    window_map[window]->pending_framebuffer_size = std::pair{width, height};
+  }
   void set_process_character_fun(auto&& fun) {
       process_character_fun = std::move(fun);
   }
   void process_character(uint32_t codepoint) {
+    get_latency_probe().key_event();
     process_character_fun(codepoint);
   }
+  void set_paste_fun(auto&& fun) {
+      paste_fun = std::move(fun);
+  }
+  void paste_clipboard() {
+      if (auto text = glfwGetClipboardString(window)) {
+          paste_fun(text);
+      }
+  }
   static void character_callback(GLFWwindow *window, unsigned int codepoint) {
     auto manager = window_map[window];
     manager->process_character(codepoint);
@@ -129,8 +164,21 @@ public:
           else if (key == GLFW_KEY_TAB) {
               manager->process_character('\t');
           }
+          else if (key == GLFW_KEY_V && (mods & (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT)) == (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT)) {
+              manager->paste_clipboard();
+          }
       }
   }
+  // Time between two refreshes of the primary monitor.
+  std::chrono::nanoseconds get_frame_interval() {
+    int refresh_rate = 60;
+    if (auto monitor = glfwGetPrimaryMonitor()) {
+      if (auto mode = glfwGetVideoMode(monitor); mode && mode->refreshRate > 0) {
+        refresh_rate = mode->refreshRate;
+      }
+    }
+    return std::chrono::nanoseconds{std::chrono::seconds{1}} / refresh_rate;
+  }
   run_result process_window_events() {
     glfwPollEvents();
     return glfwWindowShouldClose(window) ? run_result::eBreak
@@ -147,94 +195,8 @@ private:
   GLFWwindow *window;
   inline static std::map<GLFWwindow *, window_manager *> window_map; // C++17 inline static variable.
   std::function<void(uint32_t)> process_character_fun;
-};
-
-class terminal_buffer_manager {
-public:
-    terminal_buffer_manager() :
-        m_buffer{ 82, 32 }
-    {}
-  auto &get_buffer() { return m_buffer; }
-  void clear() {
-    std::for_each(m_buffer.begin(),
-                  m_buffer.end(),
-                  [](auto &c) { c = ' '; });
-    m_cursor_pos = {0,0};
-  }
-  void putc(uint32_t c) {
-      m_buffer[m_cursor_pos] = c;
-      auto& [x, y] = m_cursor_pos;
-      x += 1;
-      y += x / m_buffer.get_dim0_size();
-      x %= m_buffer.get_dim0_size();
-      y %= m_buffer.get_dim1_size();
-  }
-  void line_return() {
-      auto& [x, y] = m_cursor_pos;
-      x = 0;
-  }
-  void table_indent() {
-      auto& [x, y] = m_cursor_pos;
-      x = x/8*8+8;
-  }
-  void backspace() {
-      auto& [x, y] = m_cursor_pos;
-      if (x > 0)--x;
-      m_buffer[m_cursor_pos] = ' ';
-  }
-  void append_string(const std::string &str) {
-    auto line_begin = str.begin();
-    while (true) {
-      auto line_end = std::find(line_begin, str.end(), '\n');
-      std::string_view line{line_begin, line_end};
-      append_str_data(line);
-      if (line_end == str.end()) {
-        break;
-      }
-      line_begin = line_end + 1;
-      new_line();
-    }
-  }
-  void append_line(const std::string_view str) {
-    append_str_data(str);
-    new_line();
-  }
-  void new_line() {
-    auto leave_size = m_buffer.get_dim0_size() - m_cursor_pos.first;
-    auto current_pos = m_buffer.get_linear_index(m_cursor_pos);
-    std::for_each(m_buffer.begin() + current_pos,
-                  m_buffer.begin() + current_pos + leave_size,
-                  [](auto &c) { c = ' '; });
-    m_cursor_pos.second = (m_cursor_pos.second + 1) % m_buffer.get_dim1_size();
-    m_cursor_pos.first = 0;
-  }
-  void append_str_data(const std::string_view str) {
-    auto current_pos = m_buffer.get_linear_index(m_cursor_pos);
-    assert(m_buffer.size() > current_pos);
-    auto leave_size = m_buffer.size() - current_pos;
-    auto count = std::min(str.size(), leave_size);
-    std::copy(str.begin(), str.begin() + count, m_buffer.begin() + current_pos);
-    if (str.size() > leave_size) {
-      auto count = str.size() - leave_size;
-      std::copy(str.begin() + leave_size, str.end(), m_buffer.begin());
-    }
-
-    auto& [x, y] = m_cursor_pos;
-    x += str.size();
-    y += x / m_buffer.get_dim0_size();
-    x %= m_buffer.get_dim0_size();
-    y %= m_buffer.get_dim1_size();
-  }
-#if WIN32
-  COORD get_coord() {
-      return COORD{ static_cast<int16_t>(m_buffer.get_width()), 
-          static_cast<int16_t>(m_buffer.get_height()) };
-  }
-#endif
-
-private:
-  multidimention_vector<uint32_t> m_buffer;
-  std::pair<int, int> m_cursor_pos;
+  std::function<void(std::string_view)> paste_fun;
+  std::optional<std::pair<int, int>> pending_framebuffer_size;
 };
 
 template<class T>
@@ -269,12 +231,31 @@ private:
 class none_t {};
 
 using namespace std::literals;
+
+enum class ingest_mode {
+    // PTY reads, lexing and rendering share the io_context thread
+    single_thread,
+    // PTY reads and lexing run on their own thread, which hands screen
+    // snapshots to the io_context thread
+    dedicated_thread,
+};
+
 class terminal_emulator {
 public:
-  terminal_emulator(boost::asio::io_context& executor) : m_render{}, m_buffer_manager{} {
+  terminal_emulator(boost::asio::io_context& executor, ingest_mode mode = ingest_mode::single_thread) :
+      m_render{}, m_buffer_manager{},
+      m_executor{executor}, m_frame_timer{executor},
+      m_frame_pacer{m_render.get_frame_interval()},
+      m_ingest_mode{mode} {
+    m_buffer_manager.sync_render_buffer();
     m_render.init(
         m_buffer_manager.get_buffer());
     m_render.notify_update();
+    m_rendered_size = { m_buffer_manager.get_width(), m_buffer_manager.get_height() };
+    // the cell size the initial grid is drawn at; resizes keep it
+    auto [framebuffer_width, framebuffer_height] = m_render.get_framebuffer_size();
+    m_cell_size = { std::max(1, framebuffer_width / m_rendered_size.first),
+        std::max(1, framebuffer_height / m_rendered_size.second) };
 
     class pipe_async {
     public:
@@ -282,53 +263,49 @@ public:
             boost::asio::io_context& executor,
             std::unique_ptr<boost::asio::readable_pipe>&& read_pipe) 
             : emulator{emulator},
-            read_pipe{ std::move(read_pipe) }, lexer{},
-            buf{std::make_unique<std::array<char, 128>>()}
+            read_pipe{ std::move(read_pipe) },
+            processor{emulator.get_ingest_buffer_manager()}
         {
+            processor.set_reply_fun([&emulator](std::string_view answer) { emulator.reply_to_pty(answer); });
             async_read();
         }
 
         void operator()(const boost::system::error_code& err, std::size_t bytes_count) {
+            if (err) {
+                return;
+            }
             process_text(bytes_count);
+            buf.adapt(bytes_count);
+            read_available(max_bytes_per_wakeup - bytes_count);
+            emulator.ingest_buffer_updated();
             async_read();
         }
         void process_text(std::size_t count) {
-            std::vector<lex_result> text = lexer.lex(std::string_view{ &(*buf)[0], count});
-            for (auto lr : text) {
-                if (lr.t == lex_type::character) {
-                    if (!isprint(lr.value)) {
-                        std::cout << "not printable character:" << (int)lr.value << std::endl;
-                    }
-                    std::cout << lr.value << std::endl;
-                    emulator.m_buffer_manager.putc(lr.value);
-                }
-                else if (lr.t == lex_type::clear) {
-                    emulator.m_buffer_manager.clear();
-                }
-                else if (lr.t == lex_type::new_line) {
-                    emulator.m_buffer_manager.new_line();
-                }
-                else if (lr.t == lex_type::return_) {
-                    emulator.m_buffer_manager.line_return();
-                }
-                else if (lr.t == lex_type::table) {
-                    emulator.m_buffer_manager.table_indent();
-                }
-                else if (lr.t == lex_type::backspace) {
-                    emulator.m_buffer_manager.backspace();
-                }
-                else if (lr.t == lex_type::alarm) {
-                    //TODO - process alarm
-                }
-                else {
-                    std::cerr << "not processed lex type" << std::endl;
+            trace(trace_event::read, static_cast<uint32_t>(count));
+            get_latency_probe().read_started();
+            processor.process_text(std::string_view{ buf.data(), count});
+            get_latency_probe().read_processed();
+        }
+        // Reads what the PTY already has queued before waiting again, up to
+        // budget bytes, so a burst costs one completion instead of one per
+        // buffer. The master is non-blocking, so a drained PTY returns EAGAIN;
+        // EOF and errors are left to the next async read to report.
+        void read_available(std::size_t budget) {
+#if !WIN32
+            while (budget > 0) {
+                auto ret = ::read(read_pipe->native_handle(), buf.data(), std::min(buf.get_read_size(), budget));
+                if (ret <= 0) {
+                    break;
                 }
+                auto count = static_cast<std::size_t>(ret);
+                process_text(count);
+                buf.adapt(count);
+                budget -= std::min(count, budget);
             }
-            emulator.m_render.notify_update();
-            emulator.m_render.run();
+#endif
         }
         void async_read() {
-            auto mut_buf = boost::asio::mutable_buffer{ buf->data(), buf->size() };
+            auto mut_buf = boost::asio::mutable_buffer{ buf.data(), buf.get_read_size() };
             read_pipe->async_read_some(
                 mut_buf,
                 std::move(*this));
@@ -336,9 +313,12 @@ public:
     private:
         terminal_emulator& emulator;
         std::unique_ptr<boost::asio::readable_pipe> read_pipe;
-        std::unique_ptr<std::array<char, 128>> buf;
-        bool in_escape = false;
-        terminal_sequence_lexer lexer;
+        // local classes cannot have static data members
+        enum : std::size_t {
+            max_bytes_per_wakeup = 1024 * 1024,
+        };
+        adaptive_read_buffer buf;
+        terminal_text_processor processor;
     };
 
 #if WIN32
@@ -353,19 +333,34 @@ public:
     STARTUPINFOEXW si;
     PrepareStartupInformation(hPC, &si);
     SetUpPseudoConsole(si, m_buffer_manager.get_coord());
+    m_resize_pty = [hPC](int width, int height) {
+        ResizePseudoConsole(hPC, COORD{ static_cast<SHORT>(width), static_cast<SHORT>(height) });
+    };
     //auto shell = std::make_unique<process>("Debug/sh.exe", write_pipe_handle);
-    auto read_pipe = std::make_unique<boost::asio::readable_pipe>(executor, outputReadSide);
+    auto& read_executor = get_ingest_executor(executor);
+    auto read_pipe = std::make_unique<boost::asio::readable_pipe>(read_executor, outputReadSide);
 
     auto write_buf = std::make_shared<std::array<char, 10>>();
 
-    pipe_async pipe_async_v{ *this, executor, std::move(read_pipe) };
+    pipe_async pipe_async_v{ *this, read_executor, std::move(read_pipe) };
 
     m_render.set_process_character_fun(
         [inputWriteSide]
         (auto codepoint) mutable {
-            auto& out = *inputWriteSide;
-            *inputWriteSide << static_cast<char>(codepoint);
-            out.flush();
+            std::string bytes;
+            append_utf8(bytes, codepoint);
+            inputWriteSide->write(bytes.data(), bytes.size()).flush();
+        }
+    );
+    m_write_pty = [inputWriteSide](std::string_view bytes) {
+        inputWriteSide->write(bytes.data(), bytes.size()).flush();
+    };
+    m_render.set_paste_fun(
+        [this, inputWriteSide]
+        (std::string_view text) mutable {
+            std::string bytes;
+            append_paste(bytes, text, m_buffer_manager.get_bracketed_paste());
+            inputWriteSide->write(bytes.data(), bytes.size()).flush();
         }
     );
 #else
@@ -378,7 +373,8 @@ public:
         term.c_lflag = ECHO,
         term.c_cc;
     winsize win{
-        96, 102
+        static_cast<unsigned short>(m_buffer_manager.get_height()),
+        static_cast<unsigned short>(m_buffer_manager.get_width())
     };
     int ret = forkpty(&master, name, &term, &win);
     if (ret == -1) {
@@ -389,50 +385,289 @@ public:
         execl("/bin/sh", "/bin/sh", NULL);
     }
     int child_pid = ret;
+    m_resize_pty = [master](int width, int height) {
+        winsize win{ static_cast<unsigned short>(height), static_cast<unsigned short>(width) };
+        ioctl(master, TIOCSWINSZ, &win);
+    };
 
-    auto read_pipe = std::make_unique<boost::asio::readable_pipe>(executor, master);
-    pipe_async pipe_async_v{ *this, executor, std::move(read_pipe) };
+    // non-blocking, so that pipe_async can drain it without waiting
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    auto& read_executor = get_ingest_executor(executor);
+    auto read_pipe = std::make_unique<boost::asio::readable_pipe>(read_executor, master);
+    pipe_async pipe_async_v{ *this, read_executor, std::move(read_pipe) };
+    // the read side owns master, so input goes through a duplicate
+    m_pty_writer = std::make_unique<pty_writer<boost::asio::writable_pipe>>(
+        boost::asio::writable_pipe{ executor, dup(master) });
+    m_write_pty = [this](std::string_view bytes) {
+        m_pty_writer->write(bytes);
+    };
     m_render.set_process_character_fun(
-        [master]
-        (auto codepoint) mutable {
-            int ret = 0;
-            while (ret == 0) {
-                ret = write(master, reinterpret_cast<char*>(&codepoint), 1);
-                if (ret == -1) {
-                    throw std::runtime_error{"write fail"};
-                }
-            }
+        [this]
+        (auto codepoint) {
+            m_pty_writer->write_codepoint(codepoint);
+        }
+    );
+    m_render.set_paste_fun(
+        [this]
+        (std::string_view text) {
+            m_pty_writer->paste(text, m_buffer_manager.get_bracketed_paste());
         }
     );
 #endif
 
-    class window_run {
+#if !WIN32
+    // Wakes the loop only when the display connection has events; frames
+    // are driven by PTY updates and the frame timer (see schedule_frame).
+    class window_events {
+    public:
+        window_events(terminal_emulator& emulator, boost::asio::io_context& executor, int display_fd) :
+            emulator{emulator},
+            display{ std::make_unique<boost::asio::posix::stream_descriptor>(executor, dup(display_fd)) }
+        {
+            async_wait();
+        }
+        void operator()(const boost::system::error_code& err) {
+            if (err) {
+                return;
+            }
+            if (emulator.poll_window_events()) {
+                emulator.schedule_frame();
+                async_wait();
+            }
+        }
+        void async_wait() {
+            display->async_wait(boost::asio::posix::stream_descriptor::wait_read, std::move(*this));
+        }
+    private:
+        terminal_emulator& emulator;
+        std::unique_ptr<boost::asio::posix::stream_descriptor> display;
+    };
+#endif
+    // Without a display descriptor to wait on, window events are polled.
+    class window_poll {
     public:
-        window_run(terminal_emulator& emulator, boost::asio::io_context& executor) :
+        window_poll(terminal_emulator& emulator, boost::asio::io_context& executor) :
             emulator{emulator},
-            executor{executor},
-            timer{ executor, 1ms }
+            timer{ std::make_unique<boost::asio::steady_timer>(executor) }
         {
-            async_run();
+            async_wait();
         }
         void operator()(const boost::system::error_code& err) {
-            if (emulator.m_render.process_window_events() == run_result::eContinue) {
-                async_run();
+            if (err) {
+                return;
             }
-            else {
-                executor.stop();
+            if (emulator.poll_window_events()) {
+                emulator.schedule_frame();
+                async_wait();
             }
         }
-        void async_run() {
-            timer.expires_after(1ms);
-            timer.async_wait(std::move(*this));
+        void async_wait() {
+            timer->expires_after(1ms);
+            timer->async_wait(std::move(*this));
         }
     private:
         terminal_emulator& emulator;
-        boost::asio::io_context& executor;
-        boost::asio::steady_timer timer;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+    };
+    if (poll_window_events()) {
+#if !WIN32
+        if (auto display_fd = get_display_fd(); display_fd != -1) {
+            window_events window_events{ *this, executor, display_fd };
+        }
+        else {
+            window_poll window_poll{ *this, executor };
+        }
+#else
+        window_poll window_poll{ *this, executor };
+#endif
+        schedule_frame();
+    }
+
+#if !WIN32
+    if constexpr (trace_enabled) {
+        // kill -USR1 <pid> dumps the trace ring to stderr
+        class trace_dump {
+        public:
+            trace_dump(boost::asio::io_context& executor) :
+                signals{ std::make_unique<boost::asio::signal_set>(executor, SIGUSR1) }
+            {
+                async_wait();
+            }
+            void operator()(const boost::system::error_code& err, int signal_number) {
+                if (err) {
+                    return;
+                }
+                dump_trace(std::cerr);
+                async_wait();
+            }
+            void async_wait() {
+                signals->async_wait(std::move(*this));
+            }
+        private:
+            std::unique_ptr<boost::asio::signal_set> signals;
+        };
+        trace_dump trace_dump{ executor };
+    }
+    // kill -USR2 <pid> prints keypress-to-frame latency percentiles to stderr
+    class latency_dump {
+    public:
+        latency_dump(boost::asio::io_context& executor) :
+            signals{ std::make_unique<boost::asio::signal_set>(executor, SIGUSR2) }
+        {
+            async_wait();
+        }
+        void operator()(const boost::system::error_code& err, int signal_number) {
+            if (err) {
+                return;
+            }
+            get_latency_probe().dump(std::cerr);
+            async_wait();
+        }
+        void async_wait() {
+            signals->async_wait(std::move(*this));
+        }
+    private:
+        std::unique_ptr<boost::asio::signal_set> signals;
     };
-    window_run window_run{ *this, executor };
+    latency_dump latency_dump{ executor };
+#endif
+
+    if (m_ingest_mode == ingest_mode::dedicated_thread) {
+        m_ingest_thread = std::jthread{ [this]() { m_ingest_io.run(); } };
+    }
+  }
+  ~terminal_emulator() {
+      m_ingest_io.stop();
+  }
+  terminal_buffer_manager& get_ingest_buffer_manager() {
+      return m_ingest_mode == ingest_mode::dedicated_thread ? m_ingest_buffer_manager : m_buffer_manager;
+  }
+  boost::asio::io_context& get_ingest_executor(boost::asio::io_context& executor) {
+      return m_ingest_mode == ingest_mode::dedicated_thread ? m_ingest_io : executor;
+  }
+  // Runs on the thread that lexed the PTY output.
+  void ingest_buffer_updated() {
+      if (m_ingest_mode == ingest_mode::dedicated_thread) {
+          m_ingest_buffer_manager.take_snapshot(m_snapshots.write_buffer());
+          m_snapshots.publish();
+          // one wakeup in flight is enough; it picks up the latest snapshot
+          if (!m_snapshot_wakeup.exchange(true)) {
+              boost::asio::post(m_executor, [this]() {
+                  m_snapshot_wakeup = false;
+                  schedule_frame();
+              });
+          }
+      }
+      else {
+          m_frame_pacer.mark_dirty();
+          schedule_frame();
+      }
+  }
+  // Runs on the thread that lexed the PTY output, like ingest_buffer_updated;
+  // the PTY is only written from the io_context thread.
+  void reply_to_pty(std::string_view answer) {
+      if (m_ingest_mode == ingest_mode::dedicated_thread) {
+          boost::asio::post(m_executor, [this, answer = std::string{ answer }]() {
+              m_write_pty(answer);
+          });
+      }
+      else {
+          m_write_pty(answer);
+      }
+  }
+  // Runs on the io_context thread before a frame is presented.
+  void receive_snapshot() {
+      if (m_snapshots.update()) {
+          m_buffer_manager.restore_snapshot(m_snapshots.read_buffer());
+          m_frame_pacer.mark_dirty();
+      }
+  }
+  // Returns false, and stops the loop, once the window is closed.
+  bool poll_window_events() {
+      if (m_render.process_window_events() == run_result::eContinue) {
+          if (m_render.is_framebuffer_resized()) {
+              m_frame_pacer.mark_dirty();
+          }
+          return true;
+      }
+      m_executor.stop();
+      return false;
+  }
+  // Called whenever something may have changed the screen; m_frame_pacer
+  // decides whether to draw now, later or not at all.
+  void schedule_frame() {
+      receive_snapshot();
+      auto now = std::chrono::steady_clock::now();
+      switch (m_frame_pacer.next_action(now)) {
+      case frame_pacer::action::none:
+          break;
+      case frame_pacer::action::present:
+          present(now);
+          break;
+      case frame_pacer::action::wait:
+          m_frame_timer.expires_at(m_frame_pacer.get_next_frame());
+          m_frame_timer.async_wait([this](const boost::system::error_code& err) {
+              m_frame_pacer.timer_fired();
+              if (!err) {
+                  schedule_frame();
+              }
+          });
+          break;
+      }
+  }
+  // Resizes the screen to fit the framebuffer, reflowing its lines, and
+  // tells the child. The resize is applied where the PTY output is lexed, so
+  // with an ingest thread the new size reaches this thread by snapshot.
+  void resize_screen(std::pair<int, int> framebuffer_size) {
+      auto [framebuffer_width, framebuffer_height] = framebuffer_size;
+      if (framebuffer_width == 0 || framebuffer_height == 0) {
+          // minimized
+          return;
+      }
+      auto width = std::max(1, framebuffer_width / m_cell_size.first);
+      auto height = std::max(1, framebuffer_height / m_cell_size.second);
+      auto resize = [this, width, height](terminal_buffer_manager& buffer_manager) {
+          if (width == buffer_manager.get_width() && height == buffer_manager.get_height()) {
+              return false;
+          }
+          buffer_manager.resize(width, height);
+          m_resize_pty(width, height);
+          return true;
+      };
+      if (m_ingest_mode == ingest_mode::dedicated_thread) {
+          boost::asio::post(m_ingest_io, [this, resize]() {
+              if (resize(m_ingest_buffer_manager)) {
+                  ingest_buffer_updated();
+              }
+          });
+      }
+      else {
+          resize(m_buffer_manager);
+      }
+  }
+  void present(std::chrono::steady_clock::time_point now) {
+      if (auto framebuffer_size = m_render.take_framebuffer_resize()) {
+          resize_screen(*framebuffer_size);
+      }
+      auto& probe = get_latency_probe();
+      probe.frame_started();
+      m_frame_pacer.frame_started();
+      auto size = std::pair{ m_buffer_manager.get_width(), m_buffer_manager.get_height() };
+      if (size != m_rendered_size) {
+          m_render.init(m_buffer_manager.get_buffer());
+          m_rendered_size = size;
+      }
+      if (m_buffer_manager.sync_render_buffer().empty()) {
+          return;
+      }
+      probe.frame_rendered();
+      m_render.notify_update();
+      m_render.run();
+      probe.frame_presented();
+      m_frame_pacer.frame_presented(now);
+      // presenting can read events off the display connection into the
+      // client's queue, where the descriptor wait would not see them
+      poll_window_events();
   }
 #if WIN32
   HRESULT PrepareStartupInformation(HPCON hpc, STARTUPINFOEXW* psi)
@@ -555,12 +790,35 @@ renderer_presenter<
     >>>>>>>>>>>>>>;
       vertex_pass m_render;
   terminal_buffer_manager m_buffer_manager;
+  boost::asio::io_context& m_executor;
+  boost::asio::steady_timer m_frame_timer;
+  frame_pacer m_frame_pacer;
+  std::atomic<bool> m_snapshot_wakeup = false;
+  std::pair<int, int> m_cell_size;
+  std::pair<int, int> m_rendered_size;
+  std::function<void(int, int)> m_resize_pty;
+  std::function<void(std::string_view)> m_write_pty;
+  ingest_mode m_ingest_mode;
+  boost::asio::io_context m_ingest_io;
+  terminal_buffer_manager m_ingest_buffer_manager;
+  triple_buffer<terminal_snapshot> m_snapshots;
+#if !WIN32
+  std::unique_ptr<pty_writer<boost::asio::writable_pipe>> m_pty_writer;
+#endif
+  // declared last so it is joined before the state it uses is destroyed
+  std::jthread m_ingest_thread;
 };
 
-int main() {
+int main(int argc, char** argv) {
   try {
+      auto mode = ingest_mode::single_thread;
+      for (int i = 1; i < argc; ++i) {
+          if (argv[i] == "--ingest-thread"sv) {
+              mode = ingest_mode::dedicated_thread;
+          }
+      }
       boost::asio::io_context io{};
-      terminal_emulator emulator{ io };
+      terminal_emulator emulator{ io, mode };
     io.run();
   } catch (vk::SystemError &err) {
     std::cout << "vk::SystemError: " << err.what() << std::endl;
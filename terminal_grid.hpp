@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "terminal_cell.hpp"
+
+// Cells [first_column, last_column) of a row that changed in the render buffer.
+struct damage_span {
+    int row;
+    int first_column;
+    int last_column;
+};
+
+// Screen cells stored as rows in a ring. Logical row y lives in physical row
+// (m_top + y) % height, so scrolling by one line moves m_top and clears a
+// single row instead of copying the whole screen.
+//
+// Every write goes through modify_row(), which marks the written columns of
+// the physical row dirty: one bit per row plus the column span touched since
+// the last sync. sync_to() brings a linear render buffer up to date by
+// replaying the net scroll since the previous sync with one block move and
+// then converting only the dirty spans, and reports what it changed.
+//
+// Each row also records whether it was soft-wrapped, i.e. whether its line
+// continues on the next row, so that lines can be reflowed on resize.
+class terminal_grid {
+public:
+    terminal_grid(int width, int height) :
+        m_width{width}, m_height{height},
+        m_cells(static_cast<std::size_t>(width) * height, ' '),
+        m_dirty_rows((height + 63) / 64),
+        m_dirty_columns(height),
+        m_wrapped(height)
+    {
+        mark_all();
+    }
+    int get_width() const { return m_width; }
+    int get_height() const { return m_height; }
+
+    std::span<const terminal_cell> row(int y) const {
+        return {m_cells.data() + row_offset(y), static_cast<std::size_t>(m_width)};
+    }
+    // Returns the whole row; only [first_column, last_column) is marked dirty.
+    std::span<terminal_cell> modify_row(int y, int first_column, int last_column) {
+        if (first_column < last_column) {
+            mark(physical_row(y), first_column, last_column);
+        }
+        return {m_cells.data() + row_offset(y), static_cast<std::size_t>(m_width)};
+    }
+    std::span<terminal_cell> modify_row(int y) {
+        return modify_row(y, 0, m_width);
+    }
+    void clear_row(int y, terminal_cell blank) {
+        auto cells = modify_row(y);
+        std::fill(cells.begin(), cells.end(), blank);
+        m_wrapped[physical_row(y)] = false;
+    }
+    void clear(terminal_cell blank) {
+        std::fill(m_cells.begin(), m_cells.end(), blank);
+        std::fill(m_wrapped.begin(), m_wrapped.end(), false);
+        mark_all();
+    }
+    bool is_wrapped(int y) const {
+        return m_wrapped[physical_row(y)];
+    }
+    void set_wrapped(int y, bool wrapped) {
+        m_wrapped[physical_row(y)] = wrapped;
+    }
+    // The top row rotates to the bottom and is cleared.
+    void scroll_up(terminal_cell blank) {
+        m_top = physical_row(1);
+        clear_row(m_height - 1, blank);
+        add_pending_scroll(1);
+    }
+    // The bottom row rotates to the top and is cleared.
+    void scroll_down(terminal_cell blank) {
+        m_top = physical_row(m_height - 1);
+        clear_row(0, blank);
+        add_pending_scroll(-1);
+    }
+    // Appends the changed render-buffer spans to damage. A scroll moves
+    // every row of the render buffer, so it damages the whole screen even
+    // though only the dirty spans are converted.
+    template<class Buffer, class Convert>
+    void sync_to(Buffer& buffer, Convert convert, std::vector<damage_span>& damage) {
+        auto first = buffer.begin();
+        auto last = buffer.end();
+        auto shift = m_pending_scroll;
+        m_pending_scroll = 0;
+        if (shift > 0) {
+            std::copy(first + shift * m_width, last, first);
+        }
+        else if (shift < 0) {
+            std::copy_backward(first, last + shift * m_width, last);
+        }
+        take_dirty_rows([&](int p) {
+            auto y = p >= m_top ? p - m_top : p - m_top + m_height;
+            auto [first_column, last_column] = m_dirty_columns[p];
+            auto cells = row(y);
+            std::transform(cells.begin() + first_column, cells.begin() + last_column,
+                first + y * m_width + first_column, convert);
+            if (shift == 0) {
+                damage.push_back(damage_span{y, first_column, last_column});
+            }
+        });
+        if (shift != 0) {
+            for (int y = 0; y < m_height; ++y) {
+                damage.push_back(damage_span{y, 0, m_width});
+            }
+        }
+    }
+    // For an owner without a render buffer: calls changed(p) for each
+    // physical row written since the last call, and returns the net scroll
+    // in between. A grid is either synced or drained this way, not both.
+    template<class Changed>
+    int take_changes(Changed changed) {
+        take_dirty_rows(changed);
+        return std::exchange(m_pending_scroll, 0);
+    }
+    // Physical row p, which is logical row (p - top) mod height.
+    std::span<const terminal_cell> stored_row(int p) const {
+        return {m_cells.data() + static_cast<std::size_t>(p) * m_width, static_cast<std::size_t>(m_width)};
+    }
+    int get_top() const { return m_top; }
+    void mark_all() {
+        for (int p = 0; p < m_height; ++p) {
+            mark(p, 0, m_width);
+        }
+    }
+private:
+    // Scrolling a whole screen rewrites every row, so from there on the
+    // shift is dropped and every row is marked instead. This keeps the count
+    // bounded for owners that never sync.
+    void add_pending_scroll(int lines) {
+        m_pending_scroll += lines;
+        if (m_pending_scroll >= m_height || m_pending_scroll <= -m_height) {
+            m_pending_scroll = 0;
+            mark_all();
+        }
+    }
+    template<class Visit>
+    void take_dirty_rows(Visit visit) {
+        for (std::size_t word = 0; word < m_dirty_rows.size(); ++word) {
+            for (auto bits = m_dirty_rows[word]; bits != 0; bits &= bits - 1) {
+                auto p = static_cast<int>(word * 64) + std::countr_zero(bits);
+                visit(p);
+                m_dirty_columns[p] = {m_width, 0};
+            }
+            m_dirty_rows[word] = 0;
+        }
+    }
+    void mark(int p, int first_column, int last_column) {
+        m_dirty_rows[p / 64] |= uint64_t{1} << (p % 64);
+        auto& [first, last] = m_dirty_columns[p];
+        first = std::min(first, first_column);
+        last = std::max(last, last_column);
+    }
+    int physical_row(int y) const {
+        auto p = m_top + y;
+        return p >= m_height ? p - m_height : p;
+    }
+    std::size_t row_offset(int y) const {
+        return static_cast<std::size_t>(physical_row(y)) * m_width;
+    }
+
+    int m_width;
+    int m_height;
+    std::vector<terminal_cell> m_cells;
+    std::vector<uint64_t> m_dirty_rows;
+    std::vector<std::pair<int, int>> m_dirty_columns;
+    std::vector<uint8_t> m_wrapped;
+    int m_top = 0;
+    int m_pending_scroll = 0;
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 enum behavior{
 	REVERSE_INDEX,
 	SAVE_CURSOR_POSITION,
@@ -25,4 +27,26 @@ enum behavior{
 	CURSOR_STEADY_UNDERLINE,
 	CURSOR_BLINKING_BAR,
 	STEADY_BAR,
+	INDEX,
+	NEXT_LINE,
+	RESET_TO_INITIAL_STATE,
+	ERASE_IN_DISPLAY,
+	ERASE_IN_LINE,
+	ERASE_CHARACTER,
+	INSERT_CHARACTER,
+	DELETE_CHARACTER,
+	INSERT_LINE,
+	DELETE_LINE,
+	SCROLL_UP,
+	SCROLL_DOWN,
+	SET_SCROLLING_REGION,
+	SELECT_GRAPHIC_RENDITION,
+	SET_MODE,
+	RESET_MODE,
+	SET_PRIVATE_MODE,
+	RESET_PRIVATE_MODE,
+	DEVICE_STATUS_REPORT,
+	DEVICE_ATTRIBUTES,
+	OPERATING_SYSTEM_COMMAND,
+	DEVICE_CONTROL_STRING,
 };
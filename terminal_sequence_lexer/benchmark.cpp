@@ -0,0 +1,206 @@
+#include "terminal_sequence_lexer.hpp"
+
+#include <benchmark/benchmark.h>
+
+#ifdef TERMINAL_SEQUENCE_LEXER_HAS_FLEX
+#include <FlexLexer.h>
+#endif
+
+#include <array>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <spanstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Runs every lexer over the same corpora and reports bytes/s and tokens/s.
+// Recorded PTY captures can be added by pointing
+// TERMINAL_SEQUENCE_LEXER_CORPORA at a directory; every file in it becomes a
+// corpus named after the file.
+
+namespace {
+
+constexpr std::size_t corpus_size = 1 << 20;
+
+const auto words = std::array{
+    "error", "warning", "build", "linking", "target", "terminal", "lexer",
+    "compiling", "object", "the", "of", "src/main.cpp", "0x7ffd", "[100%]",
+};
+
+std::string make_plain_text() {
+    std::mt19937 rng{1};
+    std::string text;
+    while (text.size() < corpus_size) {
+        auto line_words = 4 + rng() % 12;
+        for (std::size_t i = 0; i < line_words; ++i) {
+            text += words[rng() % words.size()];
+            text += ' ';
+        }
+        text += "\r\n";
+    }
+    return text;
+}
+
+std::string make_colored_ls() {
+    std::mt19937 rng{2};
+    const auto colors = std::array{"01;34", "01;32", "01;36", "00", "40;33;01"};
+    std::string text;
+    while (text.size() < corpus_size) {
+        for (int i = 0; i < 6; ++i) {
+            text += "\x1b[0m\x1b[";
+            text += colors[rng() % colors.size()];
+            text += 'm';
+            text += words[rng() % words.size()];
+            text += "\x1b[0m  ";
+        }
+        text += "\r\n";
+    }
+    return text;
+}
+
+std::string make_vim_redraw() {
+    std::mt19937 rng{3};
+    std::string text;
+    while (text.size() < corpus_size) {
+        text += "\x1b[?25l\x1b[H\x1b[2J";
+        for (int row = 1; row <= 32; ++row) {
+            text += "\x1b[" + std::to_string(row) + ";1H\x1b[K";
+            if (rng() % 4 == 0) {
+                text += "\x1b[94m~\x1b[0m";
+                continue;
+            }
+            text += "\x1b[33m" + std::to_string(row) + "\x1b[0m ";
+            text += "\x1b[38;5;" + std::to_string(rng() % 256) + "m";
+            text += words[rng() % words.size()];
+            text += "\x1b[0m ";
+            text += words[rng() % words.size()];
+        }
+        text += "\x1b[32;1H\x1b[7m-- INSERT --\x1b[27m\x1b]0;vim\x07\x1b[?25h";
+    }
+    return text;
+}
+
+std::string make_utf8_log() {
+    std::mt19937 rng{4};
+    const auto phrases = std::array{
+        "\xe6\x9e\x84\xe5\xbb\xba\xe6\x88\x90\xe5\x8a\x9f",          // CJK
+        "\xe3\x82\xa8\xe3\x83\xa9\xe3\x83\xbc",                      // kana
+        "\xf0\x9f\x9a\x80\xf0\x9f\x94\xa5",                          // emoji
+        "d\xc3\xa9j\xc3\xa0 vu",                                     // latin-1
+        "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82",          // cyrillic
+    };
+    std::string text;
+    while (text.size() < corpus_size) {
+        text += "2024-01-01T00:00:00 ";
+        auto line_phrases = 2 + rng() % 6;
+        for (std::size_t i = 0; i < line_phrases; ++i) {
+            text += phrases[rng() % phrases.size()];
+            text += ' ';
+        }
+        text += "\r\n";
+    }
+    return text;
+}
+
+std::vector<std::pair<std::string, std::string>> load_corpora() {
+    std::vector<std::pair<std::string, std::string>> corpora{
+        {"plain_text", make_plain_text()},
+        {"colored_ls", make_colored_ls()},
+        {"vim_redraw", make_vim_redraw()},
+        {"utf8_log", make_utf8_log()},
+    };
+    auto dir = std::getenv("TERMINAL_SEQUENCE_LEXER_CORPORA");
+    if (dir && std::filesystem::is_directory(dir)) {
+        for (auto& entry : std::filesystem::directory_iterator{dir}) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+            std::ifstream file{entry.path(), std::ios::binary};
+            corpora.emplace_back(entry.path().filename().string(),
+                std::string{std::istreambuf_iterator<char>{file}, {}});
+        }
+    }
+    return corpora;
+}
+
+using lexer_run = std::function<std::size_t(const std::string&)>;
+
+std::size_t run_state_machine(const std::string& corpus) {
+    terminal_sequence_lexer lexer{};
+    std::size_t tokens = 0;
+    for (auto c : corpus) {
+        tokens += lexer.lex_char(c).t != lex_type::none;
+    }
+    return tokens;
+}
+
+std::size_t run_bulk(const std::string& corpus) {
+    terminal_sequence_lexer lexer{};
+    std::size_t tokens = 0;
+    lexer.lex(corpus, [&tokens](const lex_result& r) {
+        benchmark::DoNotOptimize(r);
+        ++tokens;
+    });
+    return tokens;
+}
+
+std::size_t run_vector(const std::string& corpus) {
+    terminal_sequence_lexer lexer{};
+    return lexer.lex(std::string_view{corpus}).size();
+}
+
+#ifdef TERMINAL_SEQUENCE_LEXER_HAS_FLEX
+std::size_t run_flex(const std::string& corpus) {
+    // reads the corpus in place; an istringstream would copy it every run
+    std::ispanstream in{std::span<const char>{corpus}};
+    std::ostringstream out{};
+    yyFlexLexer lexer{in, out};
+    std::size_t tokens = 0;
+    while (lexer.yylex() != 0) {
+        ++tokens;
+    }
+    return tokens;
+}
+#endif
+
+void run_benchmark(benchmark::State& state, const lexer_run& run, const std::string& corpus) {
+    std::size_t tokens = 0;
+    for (auto _ : state) {
+        tokens += run(corpus);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * corpus.size()));
+    state.counters["tokens"] = benchmark::Counter(static_cast<double>(tokens), benchmark::Counter::kIsRate);
+}
+
+}
+
+int main(int argc, char** argv) {
+    auto lexers = std::vector<std::pair<std::string, lexer_run>>{
+        {"state_machine", run_state_machine},
+        {"bulk", run_bulk},
+        {"vector", run_vector},
+#ifdef TERMINAL_SEQUENCE_LEXER_HAS_FLEX
+        {"flex", run_flex},
+#endif
+    };
+    auto corpora = load_corpora();
+    for (auto& [lexer_name, run] : lexers) {
+        for (auto& [corpus_name, corpus] : corpora) {
+            benchmark::RegisterBenchmark((lexer_name + "/" + corpus_name).c_str(),
+                [&run, &corpus](benchmark::State& state) { run_benchmark(state, run, corpus); });
+        }
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// DEC ANSI parser (VT500 series) states, after Paul Williams' state diagram.
+// Entry and exit actions are folded into the transitions that enter or leave
+// a state, so every byte costs one table lookup.
+enum class parser_state : uint8_t {
+    ground,
+    escape,
+    escape_intermediate,
+    csi_entry,
+    csi_param,
+    csi_intermediate,
+    csi_ignore,
+    dcs_entry,
+    dcs_param,
+    dcs_intermediate,
+    dcs_passthrough,
+    dcs_ignore,
+    osc_string,
+    sos_pm_apc_string,
+    count,
+};
+
+enum class parser_action : uint8_t {
+    none,
+    ignore,
+    print,
+    execute,
+    clear,
+    collect,
+    param,
+    esc_dispatch,
+    csi_dispatch,
+    hook,
+    put,
+    unhook,
+    osc_start,
+    osc_put,
+    osc_end,
+    utf8,
+};
+
+// low nibble: next state, high nibble: action
+using parser_transition = uint8_t;
+
+constexpr parser_transition make_transition(parser_action a, parser_state s) {
+    return static_cast<uint8_t>(static_cast<uint8_t>(a) << 4 | static_cast<uint8_t>(s));
+}
+constexpr parser_state transition_state(parser_transition t) {
+    return static_cast<parser_state>(t & 0x0f);
+}
+constexpr parser_action transition_action(parser_transition t) {
+    return static_cast<parser_action>(t >> 4);
+}
+
+constexpr auto parser_state_count = static_cast<std::size_t>(parser_state::count);
+using parser_table = std::array<parser_transition, parser_state_count * 256>;
+
+constexpr parser_table make_parser_table() {
+    using enum parser_action;
+    using enum parser_state;
+    parser_table table{};
+    auto set = [&table](parser_state from, int first, int last, parser_action a, parser_state to) {
+        for (int c = first; c <= last; ++c) {
+            table[static_cast<std::size_t>(from) * 256 + c] = make_transition(a, to);
+        }
+    };
+    auto set_c0 = [&set](parser_state from, parser_action a, parser_state to) {
+        set(from, 0x00, 0x17, a, to);
+        set(from, 0x19, 0x19, a, to);
+        set(from, 0x1c, 0x1f, a, to);
+    };
+
+    set_c0(ground, execute, ground);
+    set(ground, 0x20, 0x7e, print, ground);
+    set(ground, 0x7f, 0x7f, ignore, ground);
+    set(ground, 0x80, 0xff, utf8, ground);
+
+    set_c0(escape, execute, escape);
+    set(escape, 0x20, 0x2f, collect, escape_intermediate);
+    set(escape, 0x30, 0x7e, esc_dispatch, ground);
+    set(escape, 0x5b, 0x5b, clear, csi_entry);
+    set(escape, 0x5d, 0x5d, osc_start, osc_string);
+    set(escape, 0x50, 0x50, clear, dcs_entry);
+    set(escape, 0x58, 0x58, none, sos_pm_apc_string);
+    set(escape, 0x5e, 0x5f, none, sos_pm_apc_string);
+    set(escape, 0x7f, 0xff, ignore, escape);
+
+    set_c0(escape_intermediate, execute, escape_intermediate);
+    set(escape_intermediate, 0x20, 0x2f, collect, escape_intermediate);
+    set(escape_intermediate, 0x30, 0x7e, esc_dispatch, ground);
+    set(escape_intermediate, 0x7f, 0xff, ignore, escape_intermediate);
+
+    set_c0(csi_entry, execute, csi_entry);
+    set(csi_entry, 0x20, 0x2f, collect, csi_intermediate);
+    set(csi_entry, 0x30, 0x3b, param, csi_param);
+    set(csi_entry, 0x3c, 0x3f, collect, csi_param);
+    set(csi_entry, 0x40, 0x7e, csi_dispatch, ground);
+    set(csi_entry, 0x7f, 0xff, ignore, csi_entry);
+
+    set_c0(csi_param, execute, csi_param);
+    set(csi_param, 0x20, 0x2f, collect, csi_intermediate);
+    set(csi_param, 0x30, 0x3b, param, csi_param);
+    set(csi_param, 0x3c, 0x3f, ignore, csi_ignore);
+    set(csi_param, 0x40, 0x7e, csi_dispatch, ground);
+    set(csi_param, 0x7f, 0xff, ignore, csi_param);
+
+    set_c0(csi_intermediate, execute, csi_intermediate);
+    set(csi_intermediate, 0x20, 0x2f, collect, csi_intermediate);
+    set(csi_intermediate, 0x30, 0x3f, ignore, csi_ignore);
+    set(csi_intermediate, 0x40, 0x7e, csi_dispatch, ground);
+    set(csi_intermediate, 0x7f, 0xff, ignore, csi_intermediate);
+
+    set_c0(csi_ignore, execute, csi_ignore);
+    set(csi_ignore, 0x20, 0x3f, ignore, csi_ignore);
+    set(csi_ignore, 0x40, 0x7e, none, ground);
+    set(csi_ignore, 0x7f, 0xff, ignore, csi_ignore);
+
+    set_c0(dcs_entry, ignore, dcs_entry);
+    set(dcs_entry, 0x20, 0x2f, collect, dcs_intermediate);
+    set(dcs_entry, 0x30, 0x3b, param, dcs_param);
+    set(dcs_entry, 0x3c, 0x3f, collect, dcs_param);
+    set(dcs_entry, 0x40, 0x7e, hook, dcs_passthrough);
+    set(dcs_entry, 0x7f, 0xff, ignore, dcs_entry);
+
+    set_c0(dcs_param, ignore, dcs_param);
+    set(dcs_param, 0x20, 0x2f, collect, dcs_intermediate);
+    set(dcs_param, 0x30, 0x3b, param, dcs_param);
+    set(dcs_param, 0x3c, 0x3f, ignore, dcs_ignore);
+    set(dcs_param, 0x40, 0x7e, hook, dcs_passthrough);
+    set(dcs_param, 0x7f, 0xff, ignore, dcs_param);
+
+    set_c0(dcs_intermediate, ignore, dcs_intermediate);
+    set(dcs_intermediate, 0x20, 0x2f, collect, dcs_intermediate);
+    set(dcs_intermediate, 0x30, 0x3f, ignore, dcs_ignore);
+    set(dcs_intermediate, 0x40, 0x7e, hook, dcs_passthrough);
+    set(dcs_intermediate, 0x7f, 0xff, ignore, dcs_intermediate);
+
+    set_c0(dcs_passthrough, put, dcs_passthrough);
+    set(dcs_passthrough, 0x20, 0x7e, put, dcs_passthrough);
+    set(dcs_passthrough, 0x7f, 0x7f, ignore, dcs_passthrough);
+    set(dcs_passthrough, 0x80, 0xff, put, dcs_passthrough);
+
+    set(dcs_ignore, 0x00, 0xff, ignore, dcs_ignore);
+
+    set(osc_string, 0x00, 0x1f, ignore, osc_string);
+    set(osc_string, 0x07, 0x07, osc_end, ground);
+    set(osc_string, 0x20, 0xff, osc_put, osc_string);
+
+    set(sos_pm_apc_string, 0x00, 0xff, ignore, sos_pm_apc_string);
+
+    // transitions from anywhere; they override the per-state entries above
+    for (std::size_t s = 0; s < parser_state_count; ++s) {
+        auto from = static_cast<parser_state>(s);
+        set(from, 0x18, 0x18, execute, ground);
+        set(from, 0x1a, 0x1a, execute, ground);
+        set(from, 0x1b, 0x1b, clear, escape);
+    }
+    set(dcs_passthrough, 0x18, 0x18, unhook, ground);
+    set(dcs_passthrough, 0x1a, 0x1a, unhook, ground);
+    set(dcs_passthrough, 0x1b, 0x1b, unhook, escape);
+    set(osc_string, 0x18, 0x18, ignore, ground);
+    set(osc_string, 0x1a, 0x1a, ignore, ground);
+    set(osc_string, 0x1b, 0x1b, osc_end, escape);
+    return table;
+}
+
+inline constexpr parser_table parser_transitions = make_parser_table();
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERMINAL_SEQUENCE_LEXER_SSE2 1
+#endif
+
+// A byte is printable when it is 7-bit ASCII and neither a C0 control nor DEL.
+// Everything else (ESC, '\n', UTF-8 lead/continuation bytes, ...) must go
+// through the lexer state machine.
+constexpr bool is_printable_ascii(char c) {
+    auto u = static_cast<uint8_t>(c);
+    return u >= 0x20 && u < 0x7f;
+}
+
+inline const char* find_non_printable_scalar(const char* first, const char* last) {
+    while (first != last && is_printable_ascii(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+// Returns the first byte in [first, last) that is not printable ASCII,
+// or last if the whole range is printable.
+inline const char* find_non_printable(const char* first, const char* last) {
+#if defined(__AVX2__)
+    const auto space = _mm256_set1_epi8(0x20);
+    const auto del = _mm256_set1_epi8(0x7f);
+    while (last - first >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        // signed compare: bytes >= 0x80 are negative, so they are caught too
+        auto special = _mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special));
+        if (mask != 0) {
+            return first + std::countr_zero(mask);
+        }
+        first += 32;
+    }
+#endif
+#if defined(__AVX2__) || defined(TERMINAL_SEQUENCE_LEXER_SSE2)
+    {
+        const auto space = _mm_set1_epi8(0x20);
+        const auto del = _mm_set1_epi8(0x7f);
+        while (last - first >= 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            auto special = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special));
+            if (mask != 0) {
+                return first + std::countr_zero(mask);
+            }
+            first += 16;
+        }
+    }
+#endif
+    return find_non_printable_scalar(first, last);
+}
@@ -1,147 +1,330 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "behavior.hpp"
+#include "parser_table.hpp"
+#include "printable_scan.hpp"
+#include "utf8_decoder.hpp"
+
 enum class lex_type : uint8_t{
     none,
     character,
-    clear,
     new_line,
     return_,
     table,
     backspace,
     alarm,
+    text,
+    unicode_text,
+    sequence,
 };
 
 struct lex_result {
     lex_type t;
     uint32_t value;
+    // for lex_type::text: a run of printable ASCII inside the lexed input
+    // for lex_type::sequence: the OSC/DCS payload, owned by the lexer
+    std::string_view text{};
+    // for lex_type::sequence: the numeric parameters, owned by the lexer and
+    // only valid until the next sequence is lexed
+    std::span<const uint16_t> params{};
+    // for lex_type::unicode_text: decoded code points, owned by the lexer and
+    // only valid until the next run is decoded
+    std::span<const uint32_t> codepoints{};
+    // for lex_type::sequence: bit i is set when params[i] is a sub-parameter
+    // of the one before it, i.e. follows a ':' rather than a ';'
+    uint16_t subparams = 0;
 };
 
+// Parameter i of a control sequence, or def if it is missing or zero.
+inline uint16_t get_param(std::span<const uint16_t> params, std::size_t i, uint16_t def) {
+    return i < params.size() && params[i] != 0 ? params[i] : def;
+}
+
 class terminal_sequence_lexer {
 public:
+    static constexpr std::size_t max_params = 16;
+    static_assert(max_params <= 16, "lex_result::subparams has a bit per parameter");
+    static constexpr std::size_t max_intermediates = 2;
+    static constexpr std::size_t max_string = 256;
+    static constexpr std::size_t max_decoded = 256;
+
     lex_result lex_char(char c) {
-        switch (state) {
-            case 0:
-            if (c == '\x1b') {
-                state = 1;
-            }
-            else if (c == '\n') {
-                state = 0;
-                return {lex_type::new_line, 0};
-            }
-            else if (c == '\r') {
-                state = 0;
-                return {lex_type::return_, 0};
-            }
-            else if (c == '\t') {
-                state = 0;
-                return {lex_type::table, 0};
+        auto u = static_cast<uint8_t>(c);
+        auto transition = parser_transitions[static_cast<std::size_t>(state) * 256 + u];
+        state = transition_state(transition);
+        return perform(transition_action(transition), u);
+    }
+    // Streams the tokens of str into sink, one call per token, without
+    // allocating. sink is any callable taking a const lex_result&.
+    template<class Sink>
+    void lex(std::string_view str, Sink&& sink) {
+        auto it = str.data();
+        auto end = str.data() + str.size();
+        while (it != end) {
+            if (state == parser_state::ground) {
+                if (static_cast<uint8_t>(*it) >= 0x80 || utf8.pending()) {
+                    it = lex_unicode_run(it, end, sink);
+                    continue;
+                }
+                auto run_end = find_non_printable(it, end);
+                if (run_end != it) {
+                    sink(lex_result{lex_type::text, static_cast<uint32_t>(run_end - it), std::string_view{it, run_end}});
+                    it = run_end;
+                    continue;
+                }
             }
-            else if (c == '\b') {
-                state = 0;
-                return {lex_type::backspace, 0};
+            auto r = lex_char(*it++);
+            if (r.t != lex_type::none) {
+                sink(r);
             }
-            else if (c == '\a') {
-                state = 0;
-                return {lex_type::alarm, 0};
+        }
+    }
+    std::vector<lex_result> lex(std::string_view str) {
+        std::vector<lex_result> res;
+        lex(str, [&res](const lex_result& r) { res.push_back(r); });
+        return res;
+    }
+private:
+    // Decodes the run of non-ASCII bytes starting at it into code points and
+    // hands them to sink in batches. A truncated sequence at the end of the
+    // input stays pending until the next call.
+    template<class Sink>
+    const char* lex_unicode_run(const char* it, const char* end, Sink& sink) {
+        std::size_t count = 0;
+        auto flush = [this, &count, &sink]() {
+            if (count != 0) {
+                sink(lex_result{lex_type::unicode_text, static_cast<uint32_t>(count), {}, {},
+                    std::span<const uint32_t>{decoded.data(), count}});
+                count = 0;
             }
-            else if ((c & 0b11110000) == 0b11100000) {
-                state = 0b11100000;
-                value = (c & 0b00001111) << 12;
+        };
+        auto emit = [this, &count, &flush](uint32_t codepoint) {
+            decoded[count++] = codepoint;
+            if (count == decoded.size()) {
+                flush();
             }
-            else {
-                state = 0;
-                return {lex_type::character, c};
+        };
+        while (it != end) {
+            auto u = static_cast<uint8_t>(*it);
+            if (u < 0x80) {
+                utf8.interrupt(emit);
+                break;
             }
+            utf8.feed(u, emit);
+            ++it;
+        }
+        flush();
+        return it;
+    }
+    lex_result perform(parser_action action, uint8_t c) {
+        switch (action) {
+            case parser_action::print:
+            return {lex_type::character, c};
+            case parser_action::execute:
+            return execute(c);
+            case parser_action::clear:
+            clear();
             break;
-            case 1:
-            if (c == '[') {
-                state = 2;
-            }
-            else {
-                state = 0;
+            case parser_action::collect:
+            if (intermediate_count < max_intermediates) {
+                intermediates[intermediate_count++] = static_cast<char>(c);
             }
             break;
-            case 2:
-            if (isdigit(c)) {
-                state = 2;
-            }
-            else if (c == ';') {
-                state = 3;
-            }
-            else if (c == 'H') {
-                state = 4;
+            case parser_action::param:
+            if (c == ';' || c == ':') {
+                push_param();
+                next_is_subparam = c == ':';
             }
             else {
-                state = 0;
+                current_param = static_cast<uint16_t>(std::min<uint32_t>(current_param * 10u + (c - '0'), 0xffff));
+                param_started = true;
             }
             break;
-            case 3:
-            if (isdigit(c)) {
-                state = 3;
-            }
-            else {
-                state = 0;
-            }
+            case parser_action::esc_dispatch:
+            return finish(esc_dispatch(c));
+            case parser_action::csi_dispatch:
+            finish_params();
+            return finish(csi_dispatch(c));
+            case parser_action::hook:
+            finish_params();
+            string_size = 0;
             break;
-            case 4:
-            if (c == '\E') {
-                state = 5;
-            }
-            else {
-                state = 0;
+            case parser_action::put:
+            case parser_action::osc_put:
+            if (string_size < max_string) {
+                string_buffer[string_size++] = static_cast<char>(c);
             }
             break;
-            case 5:
-            if (c == '[') {
-                state = 6;
-            }
-            else {
-                state = 0;
-            }
+            case parser_action::osc_start:
+            clear();
+            string_size = 0;
             break;
-            case 6:
-            if (c == '2') {
-                state = 7;
-            }
-            else {
-                state = 0;
-            }
+            case parser_action::unhook:
+            return finish(string_result(DEVICE_CONTROL_STRING));
+            case parser_action::osc_end:
+            return finish(string_result(OPERATING_SYSTEM_COMMAND));
+            case parser_action::utf8:
+            return decode_utf8(c);
+            case parser_action::none:
+            case parser_action::ignore:
             break;
-            case 7:
-            if (c == 'J') {
-                state = 0;
-                return {lex_type::clear, 0};
-            }
-            else {
-                state = 0;
+        }
+        return {lex_type::none, 0};
+    }
+    lex_result execute(uint8_t c) {
+        switch (c) {
+            case '\n':
+            case '\v':
+            case '\f':
+            return {lex_type::new_line, 0};
+            case '\r':
+            return {lex_type::return_, 0};
+            case '\t':
+            return {lex_type::table, 0};
+            case '\b':
+            return {lex_type::backspace, 0};
+            case '\a':
+            return {lex_type::alarm, 0};
+        }
+        return {lex_type::none, 0};
+    }
+    lex_result esc_dispatch(uint8_t c) {
+        if (intermediate_count != 0) {
+            // character set designation and friends
+            return {lex_type::none, 0};
+        }
+        switch (c) {
+            case 'M': return sequence(REVERSE_INDEX);
+            case '7': return sequence(SAVE_CURSOR_POSITION);
+            case '8': return sequence(RESTORE_CURSOR_POSITION);
+            case 'D': return sequence(INDEX);
+            case 'E': return sequence(NEXT_LINE);
+            case 'c': return sequence(RESET_TO_INITIAL_STATE);
+        }
+        return {lex_type::none, 0};
+    }
+    lex_result csi_dispatch(uint8_t c) {
+        auto marker = intermediate_count == 1 ? intermediates[0] : '\0';
+        if (marker == '?') {
+            if (c == 'h' || c == 'l') {
+                auto set = c == 'h';
+                if (param_count == 1 && params[0] == 12) {
+                    return sequence(set ? START_CURSOR_BLINK : STOP_CURSOR_BLINK);
+                }
+                if (param_count == 1 && params[0] == 25) {
+                    return sequence(set ? SHOW_CURSOR : HIDE_CURSOR);
+                }
+                return sequence(set ? SET_PRIVATE_MODE : RESET_PRIVATE_MODE);
             }
-            break;
-            case 0b11100000:
-            value |= (c & 0b00111111) << 6;
-            state = 0b11100001;
-            break;
-            case 0b11100001:
-            value |= (c & 0b00111111);
-            state = 0;
-            return {lex_type::character, value};
-            break;
+            return {lex_type::none, 0};
+        }
+        if (marker == ' ' && c == 'q') {
+            constexpr auto shapes = std::array{
+                CURSOR_USER_SHAPE,
+                CURSOR_BLINK_BLOCK,
+                CURSOR_STEADY_BLOCK,
+                CURSOR_BLINK_UNDERLINE,
+                CURSOR_STEADY_UNDERLINE,
+                CURSOR_BLINKING_BAR,
+                STEADY_BAR,
+            };
+            std::size_t shape = param_count > 0 ? params[0] : 0;
+            return shape < shapes.size() ? sequence(shapes[shape]) : lex_result{lex_type::none, 0};
+        }
+        if (marker != '\0') {
+            return {lex_type::none, 0};
+        }
+        switch (c) {
+            case 'A': return sequence(CURSOR_UP);
+            case 'B': return sequence(CURSOR_DOWN);
+            case 'C': return sequence(CURSOR_FORWARD);
+            case 'D': return sequence(CURSOR_BACKWARD);
+            case 'E': return sequence(CURSOR_NEXT_LINE);
+            case 'F': return sequence(CURSOR_PREVIOUS_LINE);
+            case 'G': return sequence(CURSOR_HORIZONTAL_ABSOLUTE);
+            case 'd': return sequence(VERTICAL_LINE_POSITION_ABSOLUTE);
+            case 'H': return sequence(CURSOR_POSITION);
+            case 'f': return sequence(HORIZONTAL_VERTICAL_POSITION);
+            case 's': return sequence(SAVE_CURSOR_ANSI_SYS);
+            case 'u': return sequence(RESTORE_CURSOR_ANSI_SYS);
+            case 'J': return sequence(ERASE_IN_DISPLAY);
+            case 'K': return sequence(ERASE_IN_LINE);
+            case 'X': return sequence(ERASE_CHARACTER);
+            case '@': return sequence(INSERT_CHARACTER);
+            case 'P': return sequence(DELETE_CHARACTER);
+            case 'L': return sequence(INSERT_LINE);
+            case 'M': return sequence(DELETE_LINE);
+            case 'S': return sequence(SCROLL_UP);
+            case 'T': return sequence(SCROLL_DOWN);
+            case 'r': return sequence(SET_SCROLLING_REGION);
+            case 'm': return sequence(SELECT_GRAPHIC_RENDITION);
+            case 'h': return sequence(SET_MODE);
+            case 'l': return sequence(RESET_MODE);
+            case 'n': return sequence(DEVICE_STATUS_REPORT);
+            case 'c': return sequence(DEVICE_ATTRIBUTES);
         }
         return {lex_type::none, 0};
     }
-    std::vector<lex_result> lex(std::string_view str) {
-        std::vector<lex_result> res;
-        for (auto c : str) {
-            auto r = lex_char(c);
-            if (r.t != lex_type::none) {
-                res.push_back(r);
+    lex_result decode_utf8(uint8_t c) {
+        lex_result r{lex_type::none, 0};
+        utf8.feed(c, [&r](uint32_t codepoint) { r = {lex_type::character, codepoint}; });
+        return r;
+    }
+    lex_result sequence(behavior b) {
+        return {lex_type::sequence, b, {}, std::span<const uint16_t>{params.data(), param_count}, {}, subparams};
+    }
+    lex_result string_result(behavior b) {
+        auto r = sequence(b);
+        r.text = std::string_view{string_buffer.data(), string_size};
+        return r;
+    }
+    lex_result finish(lex_result r) {
+        clear();
+        return r;
+    }
+    void push_param() {
+        if (param_count < max_params) {
+            if (next_is_subparam) {
+                subparams |= static_cast<uint16_t>(1u << param_count);
             }
+            params[param_count++] = current_param;
         }
-        return res;
+        current_param = 0;
+        param_started = true;
     }
-private:
-    int state;
-    uint32_t value;
+    void finish_params() {
+        if (param_started) {
+            push_param();
+        }
+    }
+    void clear() {
+        param_count = 0;
+        current_param = 0;
+        param_started = false;
+        subparams = 0;
+        next_is_subparam = false;
+        intermediate_count = 0;
+    }
+
+    parser_state state = parser_state::ground;
+    utf8_decoder utf8;
+    std::array<uint32_t, max_decoded> decoded{};
+    std::array<uint16_t, max_params> params{};
+    std::size_t param_count = 0;
+    uint16_t current_param = 0;
+    bool param_started = false;
+    uint16_t subparams = 0;
+    bool next_is_subparam = false;
+    std::array<char, max_intermediates> intermediates{};
+    std::size_t intermediate_count = 0;
+    std::array<char, max_string> string_buffer{};
+    std::size_t string_size = 0;
 };
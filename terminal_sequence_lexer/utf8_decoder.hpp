@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+constexpr uint32_t replacement_character = 0xfffd;
+
+// Byte classes and states of a validating UTF-8 DFA. The special states for
+// E0, ED, F0 and F4 lead bytes reject overlong forms, surrogates and code
+// points above U+10FFFF.
+enum class utf8_class : uint8_t {
+    ascii,
+    continuation_low,   // 80..8F
+    continuation_mid,   // 90..9F
+    continuation_high,  // A0..BF
+    lead2,              // C2..DF
+    lead3_e0,
+    lead3,              // E1..EC, EE..EF
+    lead3_ed,
+    lead4_f0,
+    lead4,              // F1..F3
+    lead4_f4,
+    invalid,            // C0, C1, F5..FF
+    count,
+};
+
+enum class utf8_state : uint8_t {
+    accept,
+    reject,
+    need1,
+    need2,
+    need2_e0,
+    need2_ed,
+    need3,
+    need3_f0,
+    need3_f4,
+    count,
+};
+
+constexpr auto utf8_class_count = static_cast<std::size_t>(utf8_class::count);
+constexpr auto utf8_state_count = static_cast<std::size_t>(utf8_state::count);
+
+constexpr std::array<utf8_class, 256> make_utf8_classes() {
+    using enum utf8_class;
+    std::array<utf8_class, 256> classes{};
+    for (int c = 0; c < 256; ++c) {
+        auto& cls = classes[c];
+        if (c < 0x80) cls = ascii;
+        else if (c < 0x90) cls = continuation_low;
+        else if (c < 0xa0) cls = continuation_mid;
+        else if (c < 0xc0) cls = continuation_high;
+        else if (c < 0xc2) cls = invalid;
+        else if (c < 0xe0) cls = lead2;
+        else if (c == 0xe0) cls = lead3_e0;
+        else if (c == 0xed) cls = lead3_ed;
+        else if (c < 0xf0) cls = lead3;
+        else if (c == 0xf0) cls = lead4_f0;
+        else if (c < 0xf4) cls = lead4;
+        else if (c == 0xf4) cls = lead4_f4;
+        else cls = invalid;
+    }
+    return classes;
+}
+
+using utf8_transition_table = std::array<std::array<utf8_state, utf8_class_count>, utf8_state_count>;
+
+constexpr utf8_transition_table make_utf8_transitions() {
+    using enum utf8_state;
+    utf8_transition_table table{};
+    for (auto& row : table) {
+        row.fill(reject);
+    }
+    auto set = [&table](utf8_state from, utf8_class cls, utf8_state to) {
+        table[static_cast<std::size_t>(from)][static_cast<std::size_t>(cls)] = to;
+    };
+    auto set_continuations = [&set](utf8_state from, bool low, bool mid, bool high, utf8_state to) {
+        if (low) set(from, utf8_class::continuation_low, to);
+        if (mid) set(from, utf8_class::continuation_mid, to);
+        if (high) set(from, utf8_class::continuation_high, to);
+    };
+    set(accept, utf8_class::ascii, accept);
+    set(accept, utf8_class::lead2, need1);
+    set(accept, utf8_class::lead3_e0, need2_e0);
+    set(accept, utf8_class::lead3, need2);
+    set(accept, utf8_class::lead3_ed, need2_ed);
+    set(accept, utf8_class::lead4_f0, need3_f0);
+    set(accept, utf8_class::lead4, need3);
+    set(accept, utf8_class::lead4_f4, need3_f4);
+    set_continuations(need1, true, true, true, accept);
+    set_continuations(need2, true, true, true, need1);
+    set_continuations(need2_e0, false, false, true, need1);
+    set_continuations(need2_ed, true, true, false, need1);
+    set_continuations(need3, true, true, true, need2);
+    set_continuations(need3_f0, false, true, true, need2);
+    set_continuations(need3_f4, true, false, false, need2);
+    return table;
+}
+
+constexpr std::array<uint8_t, utf8_class_count> utf8_lead_masks{
+    0x7f, 0x3f, 0x3f, 0x3f, 0x1f, 0x0f, 0x0f, 0x0f, 0x07, 0x07, 0x07, 0x00,
+};
+
+inline constexpr auto utf8_classes = make_utf8_classes();
+inline constexpr auto utf8_transitions = make_utf8_transitions();
+
+// Incremental UTF-8 decoder. Malformed input is replaced by U+FFFD using the
+// "maximal subpart" rule: the byte that breaks a sequence starts a new one.
+class utf8_decoder {
+public:
+    // Feeds one byte and calls emit(codepoint) for every completed code point.
+    template<class Emit>
+    void feed(uint8_t byte, Emit&& emit) {
+        auto cls = utf8_classes[byte];
+        auto next = utf8_transitions[static_cast<std::size_t>(state)][static_cast<std::size_t>(cls)];
+        if (next == utf8_state::reject) {
+            emit(replacement_character);
+            if (state == utf8_state::accept) {
+                return;
+            }
+            state = utf8_state::accept;
+            cls = utf8_classes[byte];
+            next = utf8_transitions[0][static_cast<std::size_t>(cls)];
+            if (next == utf8_state::reject) {
+                emit(replacement_character);
+                return;
+            }
+        }
+        codepoint = state == utf8_state::accept
+            ? byte & utf8_lead_masks[static_cast<std::size_t>(cls)]
+            : (codepoint << 6) | (byte & 0x3f);
+        state = next;
+        if (state == utf8_state::accept) {
+            emit(codepoint);
+        }
+    }
+    // Abandons a truncated sequence, e.g. when a control byte interrupts it.
+    template<class Emit>
+    void interrupt(Emit&& emit) {
+        if (pending()) {
+            state = utf8_state::accept;
+            emit(replacement_character);
+        }
+    }
+    bool pending() const {
+        return state != utf8_state::accept;
+    }
+private:
+    utf8_state state = utf8_state::accept;
+    uint32_t codepoint = 0;
+};
@@ -0,0 +1,709 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "adaptive_read_buffer.hpp"
+#include "frame_pacer.hpp"
+#include "glyph_cache.hpp"
+#include "glyph_source.hpp"
+#include "latency_probe.hpp"
+#include "pty_writer.hpp"
+#include "scrollback.hpp"
+#include "shelld/screen_encoder.hpp"
+#include "software_renderer.hpp"
+#include "terminal_buffer_manager.hpp"
+#include "terminal_cell.hpp"
+#include "terminal_grid.hpp"
+#include "terminal_sequence_lexer.hpp"
+#include "terminal_text_processor.hpp"
+
+// Headless checks of the lexer, the screen model and the encoders. Prints
+// each failed check and exits non-zero if there was one.
+
+int failures = 0;
+
+void check(bool condition, std::string_view what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+// Logical row y of a grid as text.
+std::string grid_row_text(const terminal_grid& grid, int y) {
+    std::string text;
+    for (auto cell : grid.row(y)) {
+        text += static_cast<char>(cell_codepoint(cell));
+    }
+    return text;
+}
+
+void test_grid_ring() {
+    terminal_grid grid{4, 3};
+    for (int y = 0; y < 3; ++y) {
+        auto cells = grid.modify_row(y);
+        std::fill(cells.begin(), cells.end(), static_cast<terminal_cell>('a' + y));
+    }
+    std::vector<uint32_t> buffer(4 * 3);
+    std::vector<damage_span> damage;
+    grid.sync_to(buffer, [](terminal_cell cell) { return cell_codepoint(cell); }, damage);
+
+    grid.scroll_up(' ');
+    check(grid_row_text(grid, 0) == "bbbb" && grid_row_text(grid, 1) == "cccc" && grid_row_text(grid, 2) == "    ",
+        "scrolling up rotates the rows");
+    check(grid.get_top() == 1, "scrolling moves the top row index, not the cells");
+    std::vector<int> dirty;
+    auto scrolled = grid.take_changes([&](int p) { dirty.push_back(p); });
+    check(scrolled == 1 && dirty == std::vector<int>{0}, "only the cleared row is dirty after a scroll");
+
+    grid.scroll_down(' ');
+    grid.modify_row(1, 1, 3)[1] = 'x';
+    dirty.clear();
+    scrolled = grid.take_changes([&](int p) { dirty.push_back(p); });
+    check(scrolled == -1 && dirty.size() == 2, "rows written after a scroll are dirty");
+    check(grid.take_changes([](int) {}) == 0, "changes are taken once");
+
+    grid.scroll_up(' ');
+    grid.scroll_up(' ');
+    grid.scroll_up(' ');
+    dirty.clear();
+    scrolled = grid.take_changes([&](int p) { dirty.push_back(p); });
+    check(scrolled == 0 && dirty.size() == 3, "a scroll of a whole screen marks every row instead");
+
+    terminal_grid synced{4, 3};
+    std::vector<uint32_t> synced_buffer(4 * 3);
+    synced.sync_to(synced_buffer, [](terminal_cell cell) { return cell_codepoint(cell); }, damage);
+    for (int line = 0; line < 5; ++line) {
+        synced.scroll_up(' ');
+        auto cells = synced.modify_row(2);
+        std::fill(cells.begin(), cells.end(), static_cast<terminal_cell>('0' + line));
+        synced.sync_to(synced_buffer, [](terminal_cell cell) { return cell_codepoint(cell); }, damage);
+    }
+    check(std::string(synced_buffer.begin(), synced_buffer.end()) == "222233334444",
+        "the render buffer follows the ring after each sync");
+}
+
+void test_style_table() {
+    auto cell = make_cell(0x10ffff, max_cell_styles - 1);
+    check(cell_codepoint(cell) == 0x10ffff && cell_style_index(cell) == max_cell_styles - 1,
+        "a cell packs its codepoint and style index");
+    check(make_cell('a', 0) == 'a', "a plain character is its own cell value");
+
+    style_table styles;
+    check(styles.intern(cell_style{}) == 0, "the default style is entry 0");
+    auto red = styles.intern(cell_style{.foreground = palette_color(1)});
+    auto bold_red = styles.intern(cell_style{.foreground = palette_color(1), .attributes = attribute_bold});
+    check(red != 0 && bold_red != 0 && red != bold_red, "distinct styles get distinct entries");
+    check(styles.intern(cell_style{.foreground = palette_color(1)}) == red, "an equal style is interned once");
+    check(styles.get(bold_red).attributes == attribute_bold, "entries read back");
+
+    for (uint32_t i = 0; styles.get_styles().size() < max_cell_styles; ++i) {
+        styles.intern(cell_style{.foreground = rgb_color(i >> 16, i >> 8, i)});
+    }
+    check(styles.intern(cell_style{.background = rgb_color(1, 2, 3)}) == 0, "a full table falls back to the default style");
+    check(styles.intern(cell_style{.foreground = palette_color(1)}) == red, "existing styles are still found when full");
+
+    style_table copy;
+    copy.update_from(styles.get_styles());
+    check(copy.get_styles() == styles.get_styles() && copy.intern(cell_style{.foreground = palette_color(1)}) == red,
+        "a copy brought up to date interns to the same entries");
+}
+
+bool has_span(std::span<const damage_span> damage, damage_span span) {
+    return std::ranges::any_of(damage, [&](const damage_span& d) {
+        return d.row == span.row && d.first_column == span.first_column && d.last_column == span.last_column;
+    });
+}
+
+void test_damage() {
+    terminal_buffer_manager screen{0};
+    terminal_text_processor processor{screen};
+    screen.resize(10, 4);
+    screen.sync_render_buffer();
+    check(screen.sync_render_buffer().empty(), "nothing is damaged without changes");
+
+    processor.process_text("\x1b[2;3Hab");
+    auto damage = screen.sync_render_buffer();
+    check(has_span(damage, {1, 2, 4}), "written cells are damaged");
+    check(has_span(damage, {0, 0, 1}) && has_span(damage, {1, 4, 5}), "the old and new cursor cells are damaged");
+    check(std::ranges::none_of(damage, [](const damage_span& d) { return d.row != 0 && d.row != 1; }),
+        "other rows are not damaged");
+    auto& buffer = screen.get_buffer();
+    check(*(buffer.begin() + 12) == 'a' && *(buffer.begin() + 13) == 'b', "the render buffer holds the written cells");
+
+    processor.process_text("\x1b[4;1H\n");
+    damage = screen.sync_render_buffer();
+    bool every_row = true;
+    for (int y = 0; y < 4; ++y) {
+        every_row = every_row && has_span(damage, {y, 0, 10});
+    }
+    check(every_row && *(buffer.begin() + 2) == 'a', "a scroll damages every row and moves the render buffer");
+}
+
+struct empty_glyph_source {};
+using box_renderer = software_renderer<add_box_glyphs<empty_glyph_source>>;
+
+void test_software_renderer() {
+    // the SIMD blend must round like the scalar tail it replaces
+    std::vector<uint8_t> coverage(37);
+    std::vector<uint32_t> blended(37, rgba(10, 200, 30));
+    for (std::size_t i = 0; i < coverage.size(); ++i) {
+        coverage[i] = static_cast<uint8_t>(i * 7);
+    }
+    blend_span(blended.data(), coverage.data(), 37, rgba(250, 0, 128));
+    bool same = true;
+    for (std::size_t i = 0; i < coverage.size(); ++i) {
+        auto expected = rgba(10, 200, 30);
+        blend_span(&expected, &coverage[i], 1, rgba(250, 0, 128));
+        same = same && blended[i] == expected;
+    }
+    check(same, "blend_span gives the same result for every pixel position");
+
+    terminal_buffer_manager screen{0};
+    terminal_text_processor processor{screen};
+    screen.resize(4, 2);
+    box_renderer renderer;
+    renderer.set_default_colors(rgba(255, 255, 255), rgba(0, 0, 0));
+    processor.process_text("\xe4\xb8\xad\x1b[31mA");
+    screen.sync_render_buffer();
+    renderer.init(screen);
+    renderer.run();
+    check(renderer.get_framebuffer_width() == 32 && renderer.get_framebuffer_height() == 32, "one 8x16 box per cell");
+    auto pixel = [&](int x, int y) { return renderer.get_framebuffer()[y * renderer.get_framebuffer_width() + x]; };
+    // box outlines run from x = 1 to width - 2 and from y = height / 4 to height - 2
+    check(pixel(1, 8) == rgba(255, 255, 255) && pixel(14, 8) == rgba(255, 255, 255) && pixel(7, 8) == rgba(0, 0, 0),
+        "a wide character is drawn as one glyph across both of its cells");
+    check(pixel(17, 8) == palette_rgba(1) && pixel(16, 8) == rgba(0, 0, 0), "the next cell is drawn in its own color");
+
+    processor.process_text("\x1b[1;3H\x1b[0mB");
+    screen.sync_render_buffer();
+    renderer.notify_update();
+    renderer.run();
+    check(pixel(17, 8) == rgba(255, 255, 255) && pixel(1, 8) == rgba(255, 255, 255), "damaged cells are redrawn");
+    check(renderer.get_glyph_cache().get_misses() == 3, "each glyph is rasterized once");
+}
+
+void test_glyph_cache() {
+    // room for two 8x16 glyphs on a single shelf
+    glyph_cache cache{16, 16};
+    int rasterized = 0;
+    auto fill = [&](uint8_t value) {
+        return [&rasterized, value](std::span<uint8_t> coverage) {
+            ++rasterized;
+            std::fill(coverage.begin(), coverage.end(), value);
+            return true;
+        };
+    };
+    auto key = [](uint32_t codepoint) { return glyph_key{codepoint, 0, 8, 16}; };
+    check(cache.get(key('a'), fill(1)).coverage[0] == 1 && cache.get(key('b'), fill(2)).coverage[0] == 2,
+        "glyphs are rasterized on first use");
+    check(cache.get(key('a'), fill(9)).coverage[0] == 1 && rasterized == 2, "a cached glyph is not rasterized again");
+    check(cache.get_hits() == 1 && cache.get_misses() == 2, "hits and misses are counted");
+
+    // 'b' is now the least recently used
+    check(cache.get(key('c'), fill(3)).coverage[0] == 3 && cache.get_evictions() == 1, "a full atlas evicts a glyph");
+    check(cache.get(key('a'), fill(9)).coverage[0] == 1, "the recently used glyph stays");
+    check(cache.get(key('b'), fill(4)).coverage[0] == 4 && rasterized == 4, "the least recently used glyph was evicted");
+
+    auto glyph = cache.get(glyph_key{'w', 0, 300, 16}, fill(5));
+    check(glyph && glyph.stride == 300 && glyph.coverage[299] == 5, "a glyph too large for the atlas is still drawn");
+
+    auto misses = cache.get_misses();
+    auto empty = [&rasterized](std::span<uint8_t>) { ++rasterized; return false; };
+    check(!cache.get(key(0x2003), empty) && !cache.get(key(0x2003), empty), "a glyph with nothing to draw is empty");
+    check(rasterized == 6 && cache.get_misses() == misses + 1, "a glyph with nothing to draw is cached as such and hits");
+}
+
+// Records the writes a pty_writer starts and lets the test complete them.
+struct fake_pty {
+    std::vector<std::string> writes;
+    std::function<void(const boost::system::error_code&, std::size_t)> pending;
+
+    void complete(std::size_t written, boost::system::error_code err = {}) {
+        std::exchange(pending, nullptr)(err, written);
+    }
+};
+
+struct fake_pty_stream {
+    fake_pty* pty;
+
+    void async_write_some(std::span<const boost::asio::const_buffer> buffers, auto&& handler) {
+        std::string gathered;
+        for (auto& buffer : buffers) {
+            gathered.append(static_cast<const char*>(buffer.data()), buffer.size());
+        }
+        pty->writes.push_back(gathered);
+        pty->pending = std::forward<decltype(handler)>(handler);
+    }
+};
+
+void test_pty_writer() {
+    std::string out;
+    append_paste(out, "one\ntwo\r\nthree", false);
+    check(out == "one\rtwo\rthree", "pasted line breaks become CR");
+    out.clear();
+    append_paste(out, "a\x1b[201~b\n", true);
+    check(out == "\x1b[200~ab\r\x1b[201~", "bracketed paste is wrapped and cannot end itself early");
+
+    fake_pty stream;
+    pty_writer<fake_pty_stream> writer{fake_pty_stream{&stream}, 8};
+    writer.write_codepoint('a');
+    writer.write_codepoint('b');
+    writer.write_codepoint(0x4e2d);
+    check(stream.writes == std::vector<std::string>{"a"}, "the first key press is written at once");
+    stream.complete(1);
+    check(stream.writes.back() == "b\xe4\xb8\xad", "keys typed during a write are coalesced into the next one");
+    check(!writer.paste("123456", false) && writer.get_queued_size() == 4, "input beyond the limit is refused");
+    stream.complete(2);
+    check(stream.writes.back() == "\xb8\xad", "a partial write is resumed where it stopped");
+    stream.complete(0, boost::asio::error::broken_pipe);
+    check(writer.is_closed() && !writer.write_codepoint('x') && writer.get_queued_size() == 0,
+        "a write error closes the writer");
+}
+
+void test_frame_pacer() {
+    using namespace std::chrono_literals;
+    auto start = std::chrono::steady_clock::time_point{} + 1s;
+    frame_pacer pacer{16ms};
+    check(pacer.next_action(start) == frame_pacer::action::present, "the first frame is drawn at once");
+    pacer.frame_started();
+    pacer.frame_presented(start);
+    check(pacer.next_action(start + 1ms) == frame_pacer::action::none, "nothing is drawn while nothing changed");
+
+    pacer.mark_dirty();
+    check(pacer.next_action(start + 2ms) == frame_pacer::action::wait && pacer.get_next_frame() == start + 16ms,
+        "a change within the refresh interval waits for its end");
+    pacer.mark_dirty();
+    check(pacer.next_action(start + 3ms) == frame_pacer::action::none, "further changes do not arm another timer");
+    pacer.timer_fired();
+    check(pacer.next_action(start + 16ms) == frame_pacer::action::present, "the frame is drawn when the timer fires");
+    pacer.frame_started();
+    check(pacer.next_action(start + 16ms) == frame_pacer::action::none, "a drawn frame is no longer pending");
+
+    // a frame that showed nothing does not hold back the next one
+    pacer.mark_dirty();
+    check(pacer.next_action(start + 20ms) == frame_pacer::action::present, "an empty frame keeps the old deadline");
+}
+
+void test_latency_probe() {
+    latency_histogram histogram;
+    check(histogram.value_at_percentile(50) == 0, "an empty histogram reports 0");
+    for (uint64_t value = 1; value <= 100000; ++value) {
+        histogram.record(value);
+    }
+    auto within = [](uint64_t value, uint64_t expected) {
+        auto error = value > expected ? value - expected : expected - value;
+        return error * latency_histogram::sub_buckets <= expected;
+    };
+    check(within(histogram.value_at_percentile(50), 50000) && within(histogram.value_at_percentile(99), 99000),
+        "percentiles are within one sub-bucket of the recorded values");
+    check(histogram.get_count() == 100000 && histogram.get_max() == 100000, "count and maximum are exact");
+    latency_histogram small;
+    for (uint64_t value : {3, 5, 7, 9}) {
+        small.record(value);
+    }
+    check(small.value_at_percentile(50) == 5 && small.value_at_percentile(75) == 7, "small values are exact");
+
+    auto stage_count = [](const latency_probe& probe, std::string_view stage) {
+        std::ostringstream out;
+        probe.dump(out);
+        auto text = out.str();
+        auto line = text.find("\n" + std::string{stage} + ' ');
+        return line == std::string::npos ? -1 : std::stoi(text.substr(line + stage.size() + 2));
+    };
+    latency_probe probe;
+    probe.frame_started();
+    probe.frame_rendered();
+    probe.frame_presented();
+    check(stage_count(probe, "total") == 0, "frames without a key press are not measured");
+    probe.key_event();
+    probe.read_started();
+    probe.read_processed();
+    // another key while the first one is followed is not measured separately
+    probe.key_event();
+    probe.frame_started();
+    probe.frame_rendered();
+    probe.frame_presented();
+    check(stage_count(probe, "pty_round_trip") == 1 && stage_count(probe, "present") == 1 && stage_count(probe, "total") == 1,
+        "a key press is followed to the frame that shows its output");
+    probe.frame_started();
+    probe.frame_rendered();
+    probe.frame_presented();
+    check(stage_count(probe, "total") == 1, "a key press is measured once");
+}
+
+// Sequences lexed from the pieces of input, with their parameters.
+std::vector<std::pair<behavior, std::vector<uint16_t>>> lex_sequences(std::initializer_list<std::string_view> pieces) {
+    terminal_sequence_lexer lexer;
+    std::vector<std::pair<behavior, std::vector<uint16_t>>> sequences;
+    for (auto piece : pieces) {
+        lexer.lex(piece, [&](const lex_result& r) {
+            if (r.t == lex_type::sequence) {
+                sequences.emplace_back(static_cast<behavior>(r.value), std::vector<uint16_t>(r.params.begin(), r.params.end()));
+            }
+        });
+    }
+    return sequences;
+}
+
+// Code points lexed from the pieces of input, whichever token carried them.
+std::vector<uint32_t> lex_codepoints(std::initializer_list<std::string_view> pieces) {
+    terminal_sequence_lexer lexer;
+    std::vector<uint32_t> codepoints;
+    for (auto piece : pieces) {
+        lexer.lex(piece, [&](const lex_result& r) {
+            if (r.t == lex_type::character) {
+                codepoints.push_back(r.value);
+            }
+            else if (r.t == lex_type::text) {
+                codepoints.insert(codepoints.end(), r.text.begin(), r.text.end());
+            }
+            else if (r.t == lex_type::unicode_text) {
+                codepoints.insert(codepoints.end(), r.codepoints.begin(), r.codepoints.end());
+            }
+        });
+    }
+    return codepoints;
+}
+
+// Runs of printable ASCII come out as one text token and end at the first
+// byte that needs the state machine, wherever it falls in a SIMD block.
+void test_printable_runs() {
+    bool same = true;
+    for (int special : {0x00, 0x07, 0x0a, 0x1b, 0x1f, 0x7f, 0x80, 0xc3, 0xff}) {
+        for (std::size_t position = 0; position < 70 && same; ++position) {
+            std::string input(70, 'x');
+            input[position] = static_cast<char>(special);
+            same = find_non_printable(input.data(), input.data() + input.size()) == input.data() + position &&
+                find_non_printable_scalar(input.data(), input.data() + input.size()) == input.data() + position;
+        }
+    }
+    check(same, "the scan stops at controls, ESC, DEL and bytes from 0x80");
+
+    terminal_sequence_lexer lexer;
+    std::vector<std::string> runs;
+    std::size_t others = 0;
+    lexer.lex("hello, world\r\nsecond line\x1b[1mbold\x1b[0m caf\xc3\xa9 end", [&](const lex_result& r) {
+        if (r.t == lex_type::text) {
+            runs.emplace_back(r.text);
+        }
+        else {
+            ++others;
+        }
+    });
+    check(runs == std::vector<std::string>{"hello, world", "second line", "bold", " caf", " end"} && others == 5,
+        "text runs are split at the bytes that end them");
+}
+
+// The sink overload and the vector wrapper produce the same tokens, however
+// the input is split.
+void test_lex_sink() {
+    std::string input = "prompt$ ls\r\n\x1b[01;34mdir\x1b[0m  \xe4\xb8\xad\xe6\x96\x87\x1b]0;title\x07\x1b[2;5r\ttab\bback\a";
+    // parameters and decoded code points live in the lexer, so the ones the
+    // wrapper collected have been overwritten by later tokens
+    auto same_token = [](const lex_result& a, const lex_result& b) {
+        return a.t == b.t && a.value == b.value && (a.t != lex_type::text || a.text == b.text) &&
+            a.params.size() == b.params.size() && a.codepoints.size() == b.codepoints.size();
+    };
+    bool same = true;
+    for (std::size_t split = 0; split <= input.size() && same; ++split) {
+        terminal_sequence_lexer vector_lexer;
+        terminal_sequence_lexer sink_lexer;
+        for (auto piece : {std::string_view{input}.substr(0, split), std::string_view{input}.substr(split)}) {
+            auto tokens = vector_lexer.lex(piece);
+            std::size_t i = 0;
+            sink_lexer.lex(piece, [&](const lex_result& r) {
+                same = same && i < tokens.size() && same_token(r, tokens[i]);
+                ++i;
+            });
+            same = same && i == tokens.size();
+        }
+    }
+    check(same, "sink and vector lexing agree");
+}
+
+void test_adaptive_read_buffer() {
+    adaptive_read_buffer buffer;
+    check(buffer.get_read_size() == adaptive_read_buffer::min_read_size, "reads start small");
+    buffer.adapt(buffer.get_read_size() / 2);
+    check(buffer.get_read_size() == adaptive_read_buffer::min_read_size, "a partial read keeps the size");
+    while (buffer.get_read_size() < adaptive_read_buffer::max_read_size) {
+        buffer.adapt(buffer.get_read_size());
+    }
+    buffer.adapt(buffer.get_read_size());
+    check(buffer.get_read_size() == adaptive_read_buffer::max_read_size && buffer.get_capacity() >= buffer.get_read_size(),
+        "full reads grow the buffer up to the maximum");
+
+    for (std::size_t i = 0; i + 1 < adaptive_read_buffer::small_reads_before_shrink; ++i) {
+        buffer.adapt(10);
+    }
+    buffer.adapt(adaptive_read_buffer::max_read_size / 2);
+    for (std::size_t i = 0; i + 1 < adaptive_read_buffer::small_reads_before_shrink; ++i) {
+        buffer.adapt(10);
+    }
+    check(buffer.get_read_size() == adaptive_read_buffer::max_read_size, "a larger read restarts the run of small ones");
+    buffer.adapt(10);
+    check(buffer.get_read_size() == adaptive_read_buffer::max_read_size / 2 &&
+        buffer.get_capacity() >= adaptive_read_buffer::max_read_size, "a run of small reads halves the read size only");
+    for (int i = 0; i < 1000; ++i) {
+        buffer.adapt(10);
+    }
+    check(buffer.get_read_size() == adaptive_read_buffer::min_read_size &&
+        buffer.get_capacity() < adaptive_read_buffer::max_read_size, "memory is given back at the minimum");
+}
+
+void test_parser_table() {
+    using sequences = std::vector<std::pair<behavior, std::vector<uint16_t>>>;
+    check(lex_sequences({"\x1b[2;5r"}) == sequences{{SET_SCROLLING_REGION, {2, 5}}}, "CSI r with parameters");
+    check(lex_sequences({"\x1b[", "1", "2;", "34H"}) == sequences{{CURSOR_POSITION, {12, 34}}}, "CSI split across reads");
+    check(lex_sequences({"\x1b[?1049h\x1b[?1049l"}) ==
+        sequences{{SET_PRIVATE_MODE, {1049}}, {RESET_PRIVATE_MODE, {1049}}}, "private modes");
+    check(lex_sequences({"\x1b[?25l\x1b[?12h"}) == sequences{{HIDE_CURSOR, {25}}, {START_CURSOR_BLINK, {12}}}, "cursor modes");
+    check(lex_sequences({"\x1b[>c\x1b[?6n\x1b[=5u"}).empty(), "unknown private markers are ignored");
+    check(lex_sequences({"\x1b[6n\x1b[c\x1b[4h"}) ==
+        sequences{{DEVICE_STATUS_REPORT, {6}}, {DEVICE_ATTRIBUTES, {}}, {SET_MODE, {4}}}, "queries and modes");
+    check(lex_sequences({"\x1b" "7\x1b" "8\x1bM\x1b(B"}) ==
+        sequences{{SAVE_CURSOR_POSITION, {}}, {RESTORE_CURSOR_POSITION, {}}, {REVERSE_INDEX, {}}}, "ESC dispatch");
+    check(lex_sequences({"\x1b[3\x18" "A"}).empty() && lex_codepoints({"\x1b[3\x18" "A"}) == std::vector<uint32_t>{'A'},
+        "CAN aborts a sequence");
+    check(lex_sequences({"\x1b]0;title\x07"}).size() == 1, "OSC ends at BEL");
+
+    terminal_sequence_lexer lexer;
+    uint16_t subparams = 0xffff;
+    lexer.lex("\x1b[1;38:2::10:20:30;4:3m", [&](const lex_result& r) { subparams = r.subparams; });
+    check(subparams == 0b1'0111'1100, "colon fields are marked as sub-parameters of the one before them");
+}
+
+void test_utf8() {
+    constexpr uint32_t fffd = 0xfffd;
+    check(lex_codepoints({"\xe4\xb8\xad"}) == std::vector<uint32_t>{0x4e2d}, "three byte sequence");
+    check(lex_codepoints({"\xe4", "\xb8", "\xad"}) == std::vector<uint32_t>{0x4e2d}, "sequence split across reads");
+    check(lex_codepoints({"\xf0\x9f", "\x98\x80!"}) == std::vector<uint32_t>{0x1f600, '!'}, "four byte sequence split");
+    // the maximal subpart of a truncated sequence is one U+FFFD
+    check(lex_codepoints({"\xe2\x82" "A"}) == std::vector<uint32_t>{fffd, 'A'}, "truncated by ASCII");
+    check(lex_codepoints({"\xe2\x82", "A"}) == std::vector<uint32_t>{fffd, 'A'}, "truncated across reads");
+    check(lex_codepoints({"\xf0\x9f\x98\xe4\xb8\xad"}) == std::vector<uint32_t>{fffd, 0x4e2d}, "truncated by a lead byte");
+    // bytes that can never start or continue a sequence are one each
+    check(lex_codepoints({"\xc0\xaf"}) == std::vector<uint32_t>{fffd, fffd}, "overlong two byte form");
+    check(lex_codepoints({"\xed\xa0\x80"}) == std::vector<uint32_t>{fffd, fffd, fffd}, "surrogate");
+    check(lex_codepoints({"\xf4\x90\x80\x80"}) == std::vector<uint32_t>{fffd, fffd, fffd, fffd}, "above U+10FFFF");
+    check(lex_codepoints({"\x80z"}) == std::vector<uint32_t>{fffd, 'z'}, "lone continuation byte");
+}
+
+void test_scrollback() {
+    std::vector<terminal_cell> cells;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        auto codepoint = i % 97 < 40 ? ' ' : i % 7 == 0 ? 0x4e2d : 'a' + i % 26;
+        cells.push_back(make_cell(codepoint, i / 300 % 3 == 0 ? 0 : i / 300 % 5));
+    }
+    std::vector<terminal_cell> decoded;
+    scrollback_codec::decompress(scrollback_codec::compress(cells), decoded);
+    check(decoded == cells, "codec round trip");
+
+    // enough lines to seal chunks, so that cold ones are read back too
+    scrollback lines{64 * 1024 * 1024};
+    auto line_of = [](uint32_t n) {
+        std::vector<uint32_t> line;
+        for (uint32_t i = 0; i < n % 120; ++i) {
+            line.push_back(make_cell('a' + (n + i) % 26, n % 4));
+        }
+        return line;
+    };
+    constexpr uint32_t count = 2000;
+    for (uint32_t n = 0; n < count; ++n) {
+        lines.push_line(line_of(n), ' ', n % 3 == 0);
+    }
+    bool same = lines.size() == count;
+    for (uint32_t n = 0; n < count && same; ++n) {
+        auto expected = line_of(n);
+        auto line = lines.get_line(n);
+        same = std::equal(line.begin(), line.end(), expected.begin(), expected.end()) && lines.is_wrapped(n) == (n % 3 == 0);
+    }
+    check(same, "scrollback lines read back");
+
+    scrollback index{64 * 1024 * 1024};
+    index.push_line(line_of(1));
+    auto one_line = index.get_memory_usage();
+    for (uint32_t n = 0; n < 1000; ++n) {
+        index.push_line(line_of(1));
+    }
+    check(index.get_memory_usage() > one_line, "the hot chunk's line index is charged as it grows");
+
+    scrollback none{0};
+    none.push_line(line_of(50));
+    check(none.size() == 0 && none.get_memory_usage() == 0, "a budget of 0 keeps nothing");
+}
+
+void test_scrollback_trimming() {
+    terminal_buffer_manager screen{};
+    terminal_text_processor processor{screen};
+    screen.resize(10, 2);
+    processor.process_text("\x1b[44m\x1b[2Jab\r\n\r\n");
+    check(screen.get_scrollback().size() == 1 && screen.get_scrollback().get_line(0).size() == 2,
+        "lines are trimmed by the erase cell as they scroll off");
+}
+
+std::string row_text(terminal_buffer_manager& screen, int y) {
+    std::string text;
+    for (auto cell : screen.get_row(y)) {
+        text += static_cast<char>(cell_codepoint(cell));
+    }
+    return text.substr(0, text.find_last_not_of(' ') + 1);
+}
+
+void test_reflow() {
+    terminal_buffer_manager screen{0};
+    terminal_text_processor processor{screen};
+    screen.resize(10, 4);
+    processor.process_text("abcdefghijklmnopqrstuvwxy\r\nend");
+    check(row_text(screen, 0) == "abcdefghij" && row_text(screen, 2) == "uvwxy", "line wraps");
+    screen.resize(20, 4);
+    check(row_text(screen, 0) == "abcdefghijklmnopqrst" && row_text(screen, 1) == "uvwxy" && row_text(screen, 2) == "end",
+        "wider screen joins wrapped rows");
+    check(screen.get_cursor() == std::pair{3, 2}, "cursor follows its line");
+    screen.resize(8, 4);
+    check(row_text(screen, 0) == "ijklmnop" && row_text(screen, 2) == "y" && row_text(screen, 3) == "end",
+        "narrower screen rewraps and pushes rows up");
+    check(screen.get_cursor() == std::pair{3, 3}, "cursor stays on its line");
+}
+
+void test_screen_model() {
+    terminal_buffer_manager screen{0};
+    terminal_text_processor processor{screen};
+    std::string replies;
+    processor.set_reply_fun([&](std::string_view answer) { replies += answer; });
+    screen.resize(10, 6);
+    processor.process_text("a\r\nb\r\nc\r\nd\r\ne\r\nf");
+    processor.process_text("\x1b[2;5r\x1b[5;1H\nZZ");
+    check(row_text(screen, 0) == "a" && row_text(screen, 1) == "c" && row_text(screen, 4) == "ZZ" && row_text(screen, 5) == "f",
+        "line feed scrolls the region only");
+    processor.process_text("\x1b[2;1H\x1b[L");
+    check(row_text(screen, 1).empty() && row_text(screen, 2) == "c" && row_text(screen, 5) == "f", "insert line");
+    processor.process_text("\x1b[2M");
+    check(row_text(screen, 1) == "d" && row_text(screen, 3).empty() && row_text(screen, 5) == "f", "delete lines");
+    processor.process_text("\x1b[r\x1b[3;4H\x1b[6n\x1b[5n\x1b[c");
+    check(replies == "\x1b[3;4R\x1b[0n\x1b[?1;2c", "cursor position, status and attributes replies");
+    processor.process_text("\x1b[38:2::10:20:30;4:3m");
+    check(screen.get_style().foreground == rgb_color(10, 20, 30) && screen.get_style().attributes == attribute_underline,
+        "SGR sub-parameters with an empty colorspace");
+    processor.process_text("\x1b[0;48:5:100;38:2:1:2:3;4:0m");
+    check(screen.get_style().background == palette_color(100) && screen.get_style().foreground == rgb_color(1, 2, 3) &&
+        screen.get_style().attributes == 0, "SGR sub-parameters without a colorspace and 4:0");
+    processor.process_text("\x1b[0m\x1b[?1049hvim\x1b[?1049l");
+    check(row_text(screen, 0) == "a" && screen.get_cursor() == std::pair{3, 2}, "alternate screen leaves the main one intact");
+}
+
+// Whether actual shows what expected does: cells, their colors and
+// attributes, the cursor and the private modes.
+bool same_screen(terminal_buffer_manager& expected, terminal_buffer_manager& actual) {
+    bool same = actual.get_cursor() == expected.get_cursor() &&
+        actual.get_private_modes() == expected.get_private_modes() &&
+        actual.get_alternate_screen() == expected.get_alternate_screen();
+    for (int y = 0; y < expected.get_height() && same; ++y) {
+        auto expected_row = expected.get_row(y);
+        auto row = actual.get_row(y);
+        for (int x = 0; x < expected.get_width(); ++x) {
+            auto& expected_style = expected.get_style_table().get(cell_style_index(expected_row[x]));
+            auto& style = actual.get_style_table().get(cell_style_index(row[x]));
+            same = same && cell_codepoint(expected_row[x]) == cell_codepoint(row[x]) &&
+                expected_style.foreground == style.foreground && expected_style.background == style.background &&
+                expected_style.attributes == style.attributes;
+        }
+    }
+    return same;
+}
+
+// A client that attaches is sent the whole screen and terminal state.
+void test_encode_screen() {
+    terminal_buffer_manager screen{0};
+    terminal_text_processor processor{screen};
+    screen.resize(20, 6);
+    processor.process_text("plain\r\n\x1b[1;31mbold red\x1b[0m \xe4\xb8\xad\r\n\x1b[44m\x1b[K\x1b[0m");
+    processor.process_text("\x1b[2;5r\x1b[?1h\x1b[?1000h\x1b[?2004h\x1b[4;3H");
+    terminal_buffer_manager client{0};
+    terminal_text_processor client_processor{client};
+    client.resize(20, 6);
+    client_processor.process_text("stale\x1b[?25l");
+    client_processor.process_text(encode_screen(screen));
+    check(same_screen(screen, client), "the main screen is redrawn with its modes");
+    // raw output that follows may depend on these
+    check(client.get_scrolling_region() == std::pair{1, 5} && client.get_bracketed_paste(),
+        "the scrolling region and bracketed paste are restored");
+
+    processor.process_text("\x1b[?1049h\x1b[Hfull screen\x1b[?25l");
+    terminal_buffer_manager alternate_client{0};
+    terminal_text_processor alternate_processor{alternate_client};
+    alternate_client.resize(20, 6);
+    alternate_processor.process_text(encode_screen(screen));
+    check(same_screen(screen, alternate_client), "the alternate screen is redrawn");
+}
+
+// Feeds the screen's output to a model of the client through a
+// delta_encoder and compares the two.
+void test_delta_encoder() {
+    terminal_buffer_manager screen{0};
+    terminal_buffer_manager client{0};
+    terminal_text_processor screen_processor{screen};
+    terminal_text_processor client_processor{client};
+    screen.resize(20, 8);
+    client.resize(20, 8);
+    delta_encoder encoder;
+    client_processor.process_text(encoder.reset(screen));
+    const char* outputs[] = {
+        "one\r\ntwo\r\nthree\r\n",
+        "\x1b[31mred\x1b[0m \xe4\xb8\xad\xe6\x96\x87\r\n",
+        "\x1b[2;6r\x1b[6;1H\n\nscrolled",
+        "\x1b[3;1H\x1b[2L\x1b[M\x1b[S",
+        "\x1b[r\x1b[8;1H\n\n\nbottom",
+        "\x1b[?1049h\x1b[Hfull screen\x1b[?1h\x1b[?1000h\x1b[?25l",
+        "\x1b[5;5Hmore",
+        "\x1b[?1049l\x1b[?1l\x1b[?1000l\x1b[?25h",
+    };
+    for (auto output : outputs) {
+        screen_processor.process_text(output);
+        client_processor.process_text(encoder.encode(screen));
+        check(same_screen(screen, client), std::string{"client in sync after "} + output);
+    }
+
+    // a scroll inside a region is sent as line feeds within that region
+    terminal_buffer_manager lines{0};
+    terminal_text_processor lines_processor{lines};
+    lines.resize(10, 6);
+    lines_processor.process_text("a\r\nb\r\nc\r\nd\r\ne\r\nf");
+    delta_encoder lines_encoder;
+    lines_encoder.reset(lines);
+    lines_processor.process_text("\x1b[2;5r\x1b[5;1H\n");
+    check(lines_encoder.encode(lines) == "\x1b[0m\x1b[2;5r\x1b[5;1H\n\x1b[r\x1b[5;1H", "region scroll is sent as a line feed");
+}
+
+int main() {
+    test_printable_runs();
+    test_lex_sink();
+    test_parser_table();
+    test_utf8();
+    test_adaptive_read_buffer();
+    test_grid_ring();
+    test_style_table();
+    test_damage();
+    test_software_renderer();
+    test_glyph_cache();
+    test_pty_writer();
+    test_frame_pacer();
+    test_latency_probe();
+    test_scrollback();
+    test_scrollback_trimming();
+    test_reflow();
+    test_screen_model();
+    test_encode_screen();
+    test_delta_encoder();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "terminal_buffer_manager.hpp"
+#include "terminal_sequence_lexer.hpp"
+#include "trace.hpp"
+
+// Lexes PTY output and applies it to a terminal_buffer_manager. It does not
+// touch the window or the renderer, so it can be driven headless. Answers to
+// queries such as the cursor position report go to the reply function, which
+// should write them to the PTY.
+class terminal_text_processor {
+public:
+    terminal_text_processor(terminal_buffer_manager& buffer_manager)
+        : buffer_manager{buffer_manager}, lexer{}
+    {}
+    void set_reply_fun(auto&& fun) {
+        reply_fun = std::forward<decltype(fun)>(fun);
+    }
+    void process_text(std::string_view text) {
+        lexer.lex(text, [this](const lex_result& lr) { process_token(lr); });
+    }
+    void process_token(const lex_result& lr) {
+        if (lr.t == lex_type::character) {
+            trace(lr.value < 0x80 && !isprint(lr.value) ? trace_event::non_printable : trace_event::character, lr.value);
+            buffer_manager.putc(lr.value);
+        }
+        else if (lr.t == lex_type::text) {
+            buffer_manager.append_str_data(lr.text);
+        }
+        else if (lr.t == lex_type::unicode_text) {
+            buffer_manager.append_codepoints(lr.codepoints);
+        }
+        else if (lr.t == lex_type::sequence) {
+            process_sequence(static_cast<behavior>(lr.value), lr.params, lr.subparams);
+        }
+        else if (lr.t == lex_type::new_line) {
+            buffer_manager.new_line();
+        }
+        else if (lr.t == lex_type::return_) {
+            buffer_manager.line_return();
+        }
+        else if (lr.t == lex_type::table) {
+            buffer_manager.table_indent();
+        }
+        else if (lr.t == lex_type::backspace) {
+            buffer_manager.backspace();
+        }
+        else if (lr.t == lex_type::alarm) {
+            //TODO - process alarm
+        }
+        else {
+            trace(trace_event::unprocessed_token, static_cast<uint32_t>(lr.t));
+        }
+    }
+    void process_sequence(behavior b, std::span<const uint16_t> params, uint16_t subparams = 0) {
+        auto [x, y] = buffer_manager.get_cursor();
+        int n = get_param(params, 0, 1);
+        switch (b) {
+        case CURSOR_UP:
+            buffer_manager.move_cursor(0, -n);
+            break;
+        case CURSOR_DOWN:
+            buffer_manager.move_cursor(0, n);
+            break;
+        case CURSOR_FORWARD:
+            buffer_manager.move_cursor(n, 0);
+            break;
+        case CURSOR_BACKWARD:
+            buffer_manager.move_cursor(-n, 0);
+            break;
+        case CURSOR_NEXT_LINE:
+            buffer_manager.set_cursor(0, y + n);
+            break;
+        case CURSOR_PREVIOUS_LINE:
+            buffer_manager.set_cursor(0, y - n);
+            break;
+        case CURSOR_HORIZONTAL_ABSOLUTE:
+            buffer_manager.set_cursor(n - 1, y);
+            break;
+        case VERTICAL_LINE_POSITION_ABSOLUTE:
+            buffer_manager.set_cursor(x, n - 1);
+            break;
+        case CURSOR_POSITION:
+        case HORIZONTAL_VERTICAL_POSITION:
+            buffer_manager.set_cursor(get_param(params, 1, 1) - 1, n - 1);
+            break;
+        case SAVE_CURSOR_POSITION:
+        case SAVE_CURSOR_ANSI_SYS:
+            buffer_manager.save_cursor();
+            break;
+        case RESTORE_CURSOR_POSITION:
+        case RESTORE_CURSOR_ANSI_SYS:
+            buffer_manager.restore_cursor();
+            break;
+        case ERASE_IN_DISPLAY:
+            buffer_manager.erase_in_display(get_param(params, 0, 0));
+            break;
+        case ERASE_IN_LINE:
+            buffer_manager.erase_in_line(get_param(params, 0, 0));
+            break;
+        case ERASE_CHARACTER:
+            buffer_manager.erase_characters(n);
+            break;
+        case INSERT_CHARACTER:
+            buffer_manager.insert_characters(n);
+            break;
+        case DELETE_CHARACTER:
+            buffer_manager.delete_characters(n);
+            break;
+        case REVERSE_INDEX:
+            buffer_manager.reverse_index();
+            break;
+        case INDEX:
+            buffer_manager.index();
+            break;
+        case NEXT_LINE:
+            buffer_manager.new_line();
+            break;
+        case RESET_TO_INITIAL_STATE:
+            buffer_manager.clear();
+            break;
+        case SELECT_GRAPHIC_RENDITION:
+            select_graphic_rendition(params, subparams);
+            break;
+        case SET_PRIVATE_MODE:
+        case RESET_PRIVATE_MODE:
+            for (auto mode : params) {
+                buffer_manager.set_private_mode(mode, b == SET_PRIVATE_MODE);
+            }
+            break;
+        case SHOW_CURSOR:
+        case HIDE_CURSOR:
+            buffer_manager.set_private_mode(25, b == SHOW_CURSOR);
+            break;
+        case START_CURSOR_BLINK:
+        case STOP_CURSOR_BLINK:
+            buffer_manager.set_private_mode(12, b == START_CURSOR_BLINK);
+            break;
+        case SET_MODE:
+        case RESET_MODE:
+            for (auto mode : params) {
+                buffer_manager.set_mode(mode, b == SET_MODE);
+            }
+            break;
+        case SET_SCROLLING_REGION:
+            buffer_manager.set_scrolling_region(get_param(params, 0, 1), get_param(params, 1, 0));
+            break;
+        case INSERT_LINE:
+            buffer_manager.insert_lines(n);
+            break;
+        case DELETE_LINE:
+            buffer_manager.delete_lines(n);
+            break;
+        case SCROLL_UP:
+            buffer_manager.scroll_up(n);
+            break;
+        case SCROLL_DOWN:
+            buffer_manager.scroll_down(n);
+            break;
+        case DEVICE_STATUS_REPORT:
+            if (n == 5) {
+                reply("\x1b[0n");
+            }
+            else if (n == 6) {
+                auto column = std::min(x, buffer_manager.get_width() - 1);
+                reply("\x1b[" + std::to_string(y + 1) + ';' + std::to_string(column + 1) + 'R');
+            }
+            break;
+        case DEVICE_ATTRIBUTES:
+            // a VT100 with advanced video
+            if (get_param(params, 0, 0) == 0) {
+                reply("\x1b[?1;2c");
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    // Sub-parameters, which follow a ':' and have their bit set in
+    // subparams, belong to the parameter before them, as in 4:3 or
+    // 38:2::r:g:b, and are never read as parameters of their own.
+    void select_graphic_rendition(std::span<const uint16_t> params, uint16_t subparams = 0) {
+        auto style = buffer_manager.get_style();
+        if (params.empty()) {
+            style = cell_style{};
+        }
+        // 38 and 48 take either 5;index or 2;r;g;b.
+        auto extended_color = [&params](std::size_t& i) {
+            if (get_param(params, i + 1, 0) == 5) {
+                i += 2;
+                return palette_color(get_param(params, i, 0));
+            }
+            if (get_param(params, i + 1, 0) == 2) {
+                i += 4;
+                return rgb_color(get_param(params, i - 2, 0), get_param(params, i - 1, 0), get_param(params, i, 0));
+            }
+            i += 1;
+            return default_color;
+        };
+        // or 5:index, 2:r:g:b or 2:colorspace:r:g:b as sub-parameters
+        auto extended_subcolor = [](std::span<const uint16_t> sub) {
+            if (sub.size() >= 2 && sub[0] == 5) {
+                return palette_color(sub[1]);
+            }
+            if (sub.size() >= 4 && sub[0] == 2) {
+                auto rgb = sub.subspan(sub.size() >= 5 ? 2 : 1);
+                return rgb_color(rgb[0], rgb[1], rgb[2]);
+            }
+            return default_color;
+        };
+        for (std::size_t i = 0; i < params.size(); ++i) {
+            auto p = params[i];
+            auto sub_count = std::size_t{0};
+            while (i + sub_count + 1 < params.size() && (subparams >> (i + sub_count + 1) & 1) != 0) {
+                ++sub_count;
+            }
+            auto sub = params.subspan(i + 1, sub_count);
+            i += sub_count;
+            switch (p) {
+            case 0: style = cell_style{}; break;
+            case 1: style.attributes |= attribute_bold; break;
+            case 2: style.attributes |= attribute_faint; break;
+            case 3: style.attributes |= attribute_italic; break;
+            case 4:
+                // 4:0 is no underline; the other styles are drawn as a single one
+                if (!sub.empty() && sub[0] == 0) {
+                    style.attributes &= ~attribute_underline;
+                }
+                else {
+                    style.attributes |= attribute_underline;
+                }
+                break;
+            case 21: style.attributes |= attribute_underline; break;
+            case 5: case 6: style.attributes |= attribute_blink; break;
+            case 7: style.attributes |= attribute_inverse; break;
+            case 8: style.attributes |= attribute_hidden; break;
+            case 9: style.attributes |= attribute_strikethrough; break;
+            case 22: style.attributes &= ~(attribute_bold | attribute_faint); break;
+            case 23: style.attributes &= ~attribute_italic; break;
+            case 24: style.attributes &= ~attribute_underline; break;
+            case 25: style.attributes &= ~attribute_blink; break;
+            case 27: style.attributes &= ~attribute_inverse; break;
+            case 28: style.attributes &= ~attribute_hidden; break;
+            case 29: style.attributes &= ~attribute_strikethrough; break;
+            case 38: style.foreground = sub.empty() ? extended_color(i) : extended_subcolor(sub); break;
+            case 39: style.foreground = default_color; break;
+            case 48: style.background = sub.empty() ? extended_color(i) : extended_subcolor(sub); break;
+            case 49: style.background = default_color; break;
+            default:
+                if (p >= 30 && p <= 37) style.foreground = palette_color(p - 30);
+                else if (p >= 40 && p <= 47) style.background = palette_color(p - 40);
+                else if (p >= 90 && p <= 97) style.foreground = palette_color(p - 90 + 8);
+                else if (p >= 100 && p <= 107) style.background = palette_color(p - 100 + 8);
+                break;
+            }
+        }
+        buffer_manager.set_style(style);
+    }
+private:
+    void reply(std::string_view answer) {
+        if (reply_fun) {
+            reply_fun(answer);
+        }
+    }
+
+    terminal_buffer_manager& buffer_manager;
+    terminal_sequence_lexer lexer;
+    std::function<void(std::string_view)> reply_fun;
+};
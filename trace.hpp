@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Hot-path tracing. Records go into a fixed-size lock-free ring and are only
+// formatted when dump_trace() is called. Configure with
+// -DTERMINAL_EMULATOR_TRACE=ON; otherwise trace() compiles to nothing.
+#ifdef TERMINAL_EMULATOR_TRACE
+constexpr bool trace_enabled = true;
+#else
+constexpr bool trace_enabled = false;
+#endif
+
+enum class trace_event : uint16_t {
+    read,
+    character,
+    non_printable,
+    unprocessed_token,
+};
+
+inline const char* trace_event_name(trace_event event) {
+    switch (event) {
+        case trace_event::read: return "read";
+        case trace_event::character: return "character";
+        case trace_event::non_printable: return "non_printable";
+        case trace_event::unprocessed_token: return "unprocessed_token";
+    }
+    return "unknown";
+}
+
+struct trace_record {
+    uint64_t timestamp;
+    trace_event event;
+    uint32_t value;
+};
+
+// Multi-producer ring that overwrites the oldest records. Each slot carries
+// the sequence number it was written with, so a concurrent dump can skip
+// slots that are being rewritten. The record itself is kept in relaxed
+// atomic words, so a torn read is detected rather than being a data race.
+class trace_ring {
+public:
+    static constexpr std::size_t capacity = 1 << 16;
+
+    void record(trace_event event, uint32_t value) {
+        auto sequence = m_next.fetch_add(1, std::memory_order_relaxed);
+        auto& slot = m_slots[sequence % capacity];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp.store(
+            static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()),
+            std::memory_order_relaxed);
+        slot.payload.store(static_cast<uint64_t>(event) << 32 | value, std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_release);
+    }
+    void dump(std::ostream& out) const {
+        auto next = m_next.load(std::memory_order_acquire);
+        auto first = next > capacity ? next - capacity : 0;
+        for (auto sequence = first; sequence < next; ++sequence) {
+            auto& slot = m_slots[sequence % capacity];
+            if (slot.sequence.load(std::memory_order_acquire) != sequence + 1) {
+                continue;
+            }
+            auto payload = slot.payload.load(std::memory_order_relaxed);
+            auto record = trace_record{
+                slot.timestamp.load(std::memory_order_relaxed),
+                static_cast<trace_event>(payload >> 32),
+                static_cast<uint32_t>(payload),
+            };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != sequence + 1) {
+                continue;
+            }
+            out << record.timestamp << ' ' << trace_event_name(record.event) << ' ' << record.value << '\n';
+        }
+        out.flush();
+    }
+private:
+    struct slot {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> timestamp{0};
+        std::atomic<uint64_t> payload{0};
+    };
+    std::atomic<uint64_t> m_next{0};
+    std::array<slot, capacity> m_slots{};
+};
+
+inline trace_ring& get_trace_ring() {
+    static trace_ring ring{};
+    return ring;
+}
+
+inline void trace([[maybe_unused]] trace_event event, [[maybe_unused]] uint32_t value = 0) {
+#ifdef TERMINAL_EMULATOR_TRACE
+    get_trace_ring().record(event, value);
+#endif
+}
+
+inline void dump_trace(std::ostream& out) {
+    get_trace_ring().dump(out);
+}
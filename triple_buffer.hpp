@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one producer thread to one
+// consumer thread. The producer fills write_buffer() and publishes it; the
+// consumer picks up the most recent publication with update(). Neither side
+// ever waits for the other, and values published in between are skipped.
+template<class T>
+class triple_buffer {
+public:
+    T& write_buffer() {
+        return m_buffers[m_write];
+    }
+    void publish() {
+        m_write = m_shared.exchange(m_write | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+    // Returns true if a value was published since the previous call.
+    bool update() {
+        if ((m_shared.load(std::memory_order_relaxed) & fresh_bit) == 0) {
+            return false;
+        }
+        m_read = m_shared.exchange(m_read, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+    const T& read_buffer() const {
+        return m_buffers[m_read];
+    }
+private:
+    static constexpr uint8_t index_mask = 0b011;
+    static constexpr uint8_t fresh_bit = 0b100;
+
+    std::array<T, 3> m_buffers{};
+    uint8_t m_write = 0;
+    uint8_t m_read = 1;
+    std::atomic<uint8_t> m_shared{2};
+};
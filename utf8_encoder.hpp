@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Invalid codepoints and surrogates are written as U+FFFD.
+inline void append_utf8(std::string& out, uint32_t codepoint) {
+    if (codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint < 0xe000)) {
+        codepoint = 0xfffd;
+    }
+    if (codepoint < 0x80) {
+        out += static_cast<char>(codepoint);
+    }
+    else if (codepoint < 0x800) {
+        out += static_cast<char>(0xc0 | codepoint >> 6);
+        out += static_cast<char>(0x80 | (codepoint & 0x3f));
+    }
+    else if (codepoint < 0x10000) {
+        out += static_cast<char>(0xe0 | codepoint >> 12);
+        out += static_cast<char>(0x80 | (codepoint >> 6 & 0x3f));
+        out += static_cast<char>(0x80 | (codepoint & 0x3f));
+    }
+    else {
+        out += static_cast<char>(0xf0 | codepoint >> 18);
+        out += static_cast<char>(0x80 | (codepoint >> 12 & 0x3f));
+        out += static_cast<char>(0x80 | (codepoint >> 6 & 0x3f));
+        out += static_cast<char>(0x80 | (codepoint & 0x3f));
+    }
+}